@@ -0,0 +1,153 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+// Benchmark of the rendering of the rules and actions pages, against the
+// previous implementation running several queries for each rule.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <functional>
+
+#include <cstdio>
+
+#include "display_tables.hpp"
+
+namespace {
+
+const std::size_t repeat = 10;
+
+void create_tables(CppSQLite3DB& db){
+    db.execDML("create table source(pk_source integer primary key autoincrement, name char(20) unique, fk_pi integer);");
+    db.execDML("create table sensor(pk_sensor integer primary key autoincrement, type char(20), name char(20), fk_source integer);");
+    db.execDML("create table actuator(pk_actuator integer primary key autoincrement, name char(20), fk_source integer);");
+    db.execDML("create table action(pk_action integer primary key autoincrement, type char(20), name char(20), fk_source integer);");
+    db.execDML("create table condition(pk_condition integer primary key autoincrement, value char(20), operator char(20), fk_sensor integer, fk_actuator integer);");
+    db.execDML("create table rule(pk_rule integer primary key autoincrement, value char(20), fk_condition integer, fk_action integer, system_action integer);");
+}
+
+// Half the rules are on sensors, half on actuators, one in ten is a sleep
+void fill_tables(CppSQLite3DB& db, std::size_t rules){
+    char query[256];
+
+    db.execDML("begin transaction;");
+
+    for(std::size_t i = 0; i < 8; ++i){
+        std::snprintf(query, sizeof(query), "insert into source(name, fk_pi) values ('source%zu', 1);", i);
+        db.execDML(query);
+    }
+
+    auto devices = rules / 4 + 1;
+
+    for(std::size_t i = 0; i < devices; ++i){
+        std::snprintf(query, sizeof(query), "insert into sensor(type, name, fk_source) values ('TEMPERATURE', 'sensor%zu', %zu);", i, i % 8 + 1);
+        db.execDML(query);
+        std::snprintf(query, sizeof(query), "insert into actuator(name, fk_source) values ('actuator%zu', %zu);", i, i % 8 + 1);
+        db.execDML(query);
+        std::snprintf(query, sizeof(query), "insert into action(type, name, fk_source) values ('SIMPLE', 'action%zu', %zu);", i, i % 8 + 1);
+        db.execDML(query);
+    }
+
+    for(std::size_t i = 0; i < rules; ++i){
+        if(i % 2){
+            std::snprintf(query, sizeof(query), "insert into condition(value, operator, fk_sensor) values ('%zu', '>', %zu);", i, i % devices + 1);
+        } else {
+            std::snprintf(query, sizeof(query), "insert into condition(value, operator, fk_actuator) values ('%zu', '==', %zu);", i, i % devices + 1);
+        }
+
+        db.execDML(query);
+
+        if(i % 10 == 9){
+            std::snprintf(query, sizeof(query), "insert into rule(value, system_action, fk_condition) values ('5', 1, %zu);", i + 1);
+        } else {
+            std::snprintf(query, sizeof(query), "insert into rule(value, fk_action, fk_condition) values ('', %zu, %zu);", i % devices + 1, i + 1);
+        }
+
+        db.execDML(query);
+    }
+
+    db.execDML("commit transaction;");
+}
+
+// The previous rendering: one query per rule for the condition, the device and the action
+void legacy_rules_table(CppSQLite3DB& db, std::ostream& response){
+    char query[256];
+
+    CppSQLite3Query rule_data = db.execQuery("select fk_condition, fk_action, system_action, value from rule;");
+
+    for(; !rule_data.eof(); rule_data.nextRow()){
+        int fk_action = rule_data.getIntField(1);
+        std::string rule_value = rule_data.fieldValue(3);
+
+        std::snprintf(query, sizeof(query), "select operator, value, fk_sensor, fk_actuator from condition where pk_condition = %d;", rule_data.getIntField(0));
+        CppSQLite3Query condition_query = db.execQuery(query);
+
+        if(condition_query.getIntField(2) == 0){
+            std::snprintf(query, sizeof(query), "select name from actuator where pk_actuator=%d;", condition_query.getIntField(3));
+            CppSQLite3Query actuator_query = db.execQuery(query);
+            response << "<tr><td>" << actuator_query.fieldValue(0) << "</td><td>&nbsp;</td><td width=\"200px\">&nbsp;</td>" << std::endl;
+        } else {
+            std::snprintf(query, sizeof(query), "select name, type from sensor where pk_sensor=%d;", condition_query.getIntField(2));
+            CppSQLite3Query sensor_query = db.execQuery(query);
+            response << "<tr><td>" << sensor_query.fieldValue(0) << " (" << sensor_query.fieldValue(1) << ")</td><td>" << condition_query.fieldValue(0)
+                     << "</td><td td width=\"80px\">" << condition_query.fieldValue(1) << "</td>" << std::endl;
+        }
+
+        if(fk_action){
+            std::snprintf(query, sizeof(query), "select name, type from action where pk_action=%d;", fk_action);
+            CppSQLite3Query do_query = db.execQuery(query);
+            response << "<td>" << do_query.fieldValue(0) << " (" << do_query.fieldValue(1) << ")</td><td>" << rule_value << "</td></tr>" << std::endl;
+        } else {
+            response << "<td>sleep (system)</td><td>" << rule_value << "</td></tr>" << std::endl;
+        }
+    }
+}
+
+double measure(CppSQLite3DB& db, const std::function<void(CppSQLite3DB&, std::ostream&)>& render, std::size_t& bytes){
+    auto start = std::chrono::steady_clock::now();
+
+    for(std::size_t i = 0; i < repeat; ++i){
+        std::ostringstream response;
+        render(db, response);
+        bytes = response.str().size();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / double(repeat) / 1000.0;
+}
+
+} //end of anonymous namespace
+
+int main(){
+    std::printf("%8s %12s %12s %12s %12s %10s\n", "rules", "legacy(ms)", "joined(ms)", "actions(ms)", "us/rule", "bytes");
+
+    for(std::size_t rules : {10, 100, 1000, 5000, 20000}){
+        CppSQLite3DB db;
+        db.open(":memory:");
+
+        create_tables(db);
+        fill_tables(db, rules);
+
+        std::size_t legacy_bytes  = 0;
+        std::size_t joined_bytes  = 0;
+        std::size_t actions_bytes = 0;
+
+        auto legacy  = measure(db, legacy_rules_table, legacy_bytes);
+        auto joined  = measure(db, display_rules_table, joined_bytes);
+        auto actions = measure(db, display_actions_list, actions_bytes);
+
+        if(legacy_bytes != joined_bytes){
+            std::cerr << "The joined rendering differs from the legacy one" << std::endl;
+            return 1;
+        }
+
+        std::printf("%8zu %12.3f %12.3f %12.3f %12.3f %10zu\n", rules, legacy, joined, actions, 1000.0 * joined / rules, joined_bytes);
+    }
+
+    return 0;
+}
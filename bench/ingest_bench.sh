@@ -0,0 +1,53 @@
+#!/bin/bash
+#=======================================================================
+# Copyright (c) 2015-2016 Baptiste Wicht
+# Distributed under the terms of the MIT License.
+# (See accompanying file LICENSE or copy at
+#  http://opensource.org/licenses/MIT)
+#=======================================================================
+
+# Run the server against a temporary asgard.db and drive it with the
+# synthetic drivers. The arguments are given to the load generator, e.g.
+#
+#   ./bench/ingest_bench.sh --drivers 16 --sensors 8 --rate 10 --duration 60
+#
+# The server reads its usual configuration, ASGARD_PORT must match its
+# server_socket_port.
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=${ASGARD_PORT:-8083}
+work=$(mktemp -d /tmp/asgard_bench.XXXXXX)
+
+cleanup() {
+    if [ -n "$server" ]; then
+        kill "$server" 2>/dev/null || true
+        wait "$server" 2>/dev/null || true
+    fi
+
+    rm -rf "$work"
+}
+
+trap cleanup EXIT INT TERM
+
+# The database is opened in the working directory of the server
+cd "$work"
+"$root/release/bin/server" > server.log 2>&1 &
+server=$!
+
+# Wait for the driver socket
+tries=0
+until (echo > "/dev/tcp/127.0.0.1/$port") 2>/dev/null; do
+    tries=$((tries + 1))
+
+    if [ $tries -gt 50 ] || ! kill -0 "$server" 2>/dev/null; then
+        echo "ingest_bench: the server did not start, its log follows" >&2
+        cat server.log >&2
+        exit 1
+    fi
+
+    sleep 0.1
+done
+
+"$root/release/bin/load_generator" --port "$port" --pid "$server" --db "$work/asgard.db" "$@"
@@ -0,0 +1,444 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+// Synthetic drivers for the ingest benchmark. Each driver registers a source
+// with its sensors and actuators over the text protocol, sends DATA and EVENT
+// messages at a fixed rate and measures the round trip of a PING through the
+// event loop of the server.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "CppSQLite3.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+    std::string host  = "127.0.0.1";
+    int port          = 8083;
+    std::size_t drivers   = 4;
+    std::size_t sensors   = 8;    ///< Sensors of each driver
+    std::size_t actuators = 1;    ///< Actuators of each driver
+    double rate           = 1.0;  ///< Samples per second of each sensor
+    double event_rate     = 0.1;  ///< Events per second of each actuator
+    double duration       = 30.0; ///< Seconds of load
+    std::size_t ping_ms   = 100;  ///< Time between two pings of a driver
+    std::string db        = "asgard.db";
+    int pid               = 0;    ///< Server process, for the CPU use
+};
+
+// A ping without answer after this time is lost. The server reads one text
+// message per segment, a ping merged with the previous message is never answered.
+const std::chrono::milliseconds ping_timeout(1000);
+
+// Time given to the database writer to commit the last batch
+const std::chrono::milliseconds settle_time(1500);
+
+struct driver_stats {
+    std::size_t samples = 0;
+    std::size_t events  = 0;
+    std::size_t pings   = 0;
+    std::size_t lost    = 0;
+    std::size_t errors  = 0;
+    std::vector<double> latencies_us;
+};
+
+bool send_message(int fd, const std::string& message){
+    return send(fd, message.c_str(), message.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(message.size());
+}
+
+// Send a registration and wait for the id given back by the server
+bool request_id(int fd, const std::string& message, int& id){
+    if(!send_message(fd, message)){
+        return false;
+    }
+
+    char answer[64];
+    auto n = recv(fd, answer, sizeof(answer) - 1, 0);
+
+    if(n <= 0){
+        return false;
+    }
+
+    answer[n] = '\0';
+    id = std::atoi(answer);
+    return true;
+}
+
+int connect_driver(const options& opts){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port   = htons(opts.port);
+    inet_pton(AF_INET, opts.host.c_str(), &address.sin_addr);
+
+    if(connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0){
+        close(fd);
+        return -1;
+    }
+
+    // The text protocol reads one message per segment, do not merge them
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    return fd;
+}
+
+void run_driver(const options& opts, std::size_t index, clock_type::time_point start, driver_stats& stats){
+    int fd = connect_driver(opts);
+    if(fd < 0){
+        std::perror("load_generator: connect");
+        ++stats.errors;
+        return;
+    }
+
+    char message[128];
+
+    int source_id = 0;
+    std::snprintf(message, sizeof(message), "REG_SOURCE bench%zu", index);
+    if(!request_id(fd, message, source_id)){
+        ++stats.errors;
+        close(fd);
+        return;
+    }
+
+    std::vector<int> sensors(opts.sensors);
+    std::vector<int> actuators(opts.actuators);
+
+    for(std::size_t i = 0; i < opts.sensors; ++i){
+        std::snprintf(message, sizeof(message), "REG_SENSOR %d TEMPERATURE bench%zu_s%zu", source_id, index, i);
+        if(!request_id(fd, message, sensors[i])){
+            ++stats.errors;
+        }
+    }
+
+    for(std::size_t i = 0; i < opts.actuators; ++i){
+        std::snprintf(message, sizeof(message), "REG_ACTUATOR %d bench%zu_a%zu", source_id, index, i);
+        if(!request_id(fd, message, actuators[i])){
+            ++stats.errors;
+        }
+    }
+
+    // The drivers start together once registered
+    std::this_thread::sleep_until(start);
+
+    clock_type::time_point end = start + std::chrono::microseconds(static_cast<long long>(opts.duration * 1e6));
+
+    // The devices of the driver are served round robin
+    auto sample_period = opts.sensors && opts.rate > 0
+        ? std::chrono::nanoseconds(static_cast<long long>(1e9 / (opts.rate * opts.sensors))) : std::chrono::nanoseconds::max();
+    auto event_period = opts.actuators && opts.event_rate > 0
+        ? std::chrono::nanoseconds(static_cast<long long>(1e9 / (opts.event_rate * opts.actuators))) : std::chrono::nanoseconds::max();
+
+    // Spread the drivers over the first period
+    const std::chrono::nanoseconds never = std::chrono::hours(24);
+    const auto slot = static_cast<std::chrono::nanoseconds::rep>(index);
+    const auto slots = static_cast<std::chrono::nanoseconds::rep>(opts.drivers);
+
+    clock_type::time_point next_sample = start + (sample_period == std::chrono::nanoseconds::max() ? never : sample_period * slot / slots);
+    clock_type::time_point next_event  = start + (event_period == std::chrono::nanoseconds::max() ? never : event_period * slot / slots);
+    clock_type::time_point next_ping   = start + std::chrono::milliseconds(opts.ping_ms);
+
+    std::size_t sample_index = 0;
+    std::size_t event_index  = 0;
+    std::size_t ping_token   = 1;
+    bool ping_pending        = false;
+    clock_type::time_point ping_time;
+
+    double value = 20.0;
+
+    while(true){
+        auto now = clock_type::now();
+
+        if(now >= end && !ping_pending){
+            break;
+        }
+
+        while(now < end && next_sample <= now){
+            value += (std::rand() % 100 - 50) / 100.0;
+            std::snprintf(message, sizeof(message), "DATA %d %d %.2f", source_id, sensors[sample_index++ % sensors.size()], value);
+
+            if(send_message(fd, message)){
+                ++stats.samples;
+            } else {
+                ++stats.errors;
+            }
+
+            next_sample += sample_period;
+        }
+
+        while(now < end && next_event <= now){
+            std::snprintf(message, sizeof(message), "EVENT %d %d %zu", source_id, actuators[event_index % actuators.size()], event_index % 2);
+            ++event_index;
+
+            if(send_message(fd, message)){
+                ++stats.events;
+            } else {
+                ++stats.errors;
+            }
+
+            next_event += event_period;
+        }
+
+        if(ping_pending && now - ping_time > ping_timeout){
+            ++stats.lost;
+            ping_pending = false;
+        }
+
+        if(!ping_pending && now < end && next_ping <= now){
+            std::snprintf(message, sizeof(message), "PING %zu", ping_token);
+
+            if(send_message(fd, message)){
+                ping_time    = clock_type::now();
+                ping_pending = true;
+                ++stats.pings;
+            }
+
+            next_ping += std::chrono::milliseconds(opts.ping_ms);
+        }
+
+        // Wait for the answer of the ping or the next message
+        auto wake = std::min({next_sample, next_event, next_ping, end});
+        if(ping_pending){
+            wake = std::min(wake, ping_time + ping_timeout);
+        }
+
+        auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake - clock_type::now()).count();
+
+        struct pollfd poll_fd{fd, POLLIN, 0};
+        if(poll(&poll_fd, 1, static_cast<int>(std::max<long long>(wait_ms, 0))) > 0){
+            char answer[64];
+            auto n = recv(fd, answer, sizeof(answer) - 1, MSG_DONTWAIT);
+
+            if(n <= 0){
+                ++stats.errors;
+                break;
+            }
+
+            answer[n] = '\0';
+
+            // Answers of the lost pings arrive late, they are ignored
+            if(ping_pending && std::strtoul(answer, nullptr, 10) == ping_token){
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - ping_time);
+                stats.latencies_us.push_back(latency.count());
+                ping_pending = false;
+                ++ping_token;
+            }
+        }
+    }
+
+    std::snprintf(message, sizeof(message), "UNREG_SOURCE %d", source_id);
+    send_message(fd, message);
+
+    close(fd);
+}
+
+// CPU time (user + system) of the process, in seconds
+double process_cpu(int pid){
+    if(!pid){
+        return 0.0;
+    }
+
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    auto file = std::fopen(path, "r");
+    if(!file){
+        return 0.0;
+    }
+
+    // The name (field 2) is between parentheses and can contain spaces
+    char line[1024];
+    auto read = std::fgets(line, sizeof(line), file);
+    std::fclose(file);
+
+    if(!read){
+        return 0.0;
+    }
+
+    auto fields = std::strrchr(line, ')');
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+
+    if(!fields || std::sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2){
+        return 0.0;
+    }
+
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+std::size_t file_size(const std::string& path){
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_size : 0;
+}
+
+std::size_t db_size(const options& opts){
+    return file_size(opts.db) + file_size(opts.db + "-wal");
+}
+
+// Number of samples stored for the sensors of the benchmark
+long long stored_samples(const options& opts){
+    try {
+        CppSQLite3DB db;
+        db.open(opts.db.c_str());
+
+        return db.execScalar(
+            "select count(*) from sensor_value where fk_sensor in (select pk_sensor from sensor where name like 'bench%');");
+    } catch (CppSQLite3Exception& e) {
+        std::cerr << "load_generator: " << e.errorMessage() << std::endl;
+    }
+
+    return -1;
+}
+
+double percentile(const std::vector<double>& sorted, double p){
+    if(sorted.empty()){
+        return 0.0;
+    }
+
+    auto rank = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+bool parse_options(int argc, char** argv, options& opts){
+    for(int i = 1; i + 1 < argc; i += 2){
+        std::string key   = argv[i];
+        std::string value = argv[i + 1];
+
+        if(key == "--host"){
+            opts.host = value;
+        } else if(key == "--port"){
+            opts.port = std::atoi(value.c_str());
+        } else if(key == "--drivers"){
+            opts.drivers = std::strtoul(value.c_str(), nullptr, 10);
+        } else if(key == "--sensors"){
+            opts.sensors = std::strtoul(value.c_str(), nullptr, 10);
+        } else if(key == "--actuators"){
+            opts.actuators = std::strtoul(value.c_str(), nullptr, 10);
+        } else if(key == "--rate"){
+            opts.rate = std::atof(value.c_str());
+        } else if(key == "--event-rate"){
+            opts.event_rate = std::atof(value.c_str());
+        } else if(key == "--duration"){
+            opts.duration = std::atof(value.c_str());
+        } else if(key == "--ping-ms"){
+            opts.ping_ms = std::strtoul(value.c_str(), nullptr, 10);
+        } else if(key == "--db"){
+            opts.db = value;
+        } else if(key == "--pid"){
+            opts.pid = std::atoi(value.c_str());
+        } else {
+            std::cerr << "load_generator: unknown option " << key << std::endl;
+            return false;
+        }
+    }
+
+    return argc % 2 == 1 && opts.drivers > 0 && opts.ping_ms > 0;
+}
+
+} //end of anonymous namespace
+
+int main(int argc, char** argv){
+    options opts;
+
+    if(!parse_options(argc, argv, opts)){
+        std::cerr << "usage: load_generator [--host h] [--port p] [--drivers n] [--sensors m] [--actuators a]" << std::endl
+                  << "                      [--rate samples/s] [--event-rate events/s] [--duration s] [--ping-ms ms]" << std::endl
+                  << "                      [--db asgard.db] [--pid server]" << std::endl;
+        return 1;
+    }
+
+    auto stored_before = stored_samples(opts);
+    auto size_before   = db_size(opts);
+
+    // Leave the time to register all the devices
+    auto start = clock_type::now() + std::chrono::milliseconds(500 + 20 * opts.drivers * (1 + opts.sensors + opts.actuators));
+
+    std::vector<driver_stats> stats(opts.drivers);
+    std::vector<std::thread> drivers;
+
+    for(std::size_t i = 0; i < opts.drivers; ++i){
+        drivers.emplace_back(run_driver, std::cref(opts), i, start, std::ref(stats[i]));
+    }
+
+    std::this_thread::sleep_until(start);
+    auto cpu_before = process_cpu(opts.pid);
+
+    for(auto& driver : drivers){
+        driver.join();
+    }
+
+    auto elapsed   = std::chrono::duration<double>(clock_type::now() - start).count();
+    auto cpu_after = process_cpu(opts.pid);
+
+    std::this_thread::sleep_for(settle_time);
+
+    auto stored_after = stored_samples(opts);
+    auto size_after   = db_size(opts);
+
+    driver_stats total;
+    for(auto& driver : stats){
+        total.samples += driver.samples;
+        total.events  += driver.events;
+        total.pings   += driver.pings;
+        total.lost    += driver.lost;
+        total.errors  += driver.errors;
+        total.latencies_us.insert(total.latencies_us.end(), driver.latencies_us.begin(), driver.latencies_us.end());
+    }
+
+    std::sort(total.latencies_us.begin(), total.latencies_us.end());
+
+    auto stored = stored_after - stored_before;
+    auto growth = static_cast<long long>(size_after) - static_cast<long long>(size_before);
+
+    std::printf("drivers %zu, sensors %zu, actuators %zu, %.1fs\n", opts.drivers, opts.drivers * opts.sensors, opts.drivers * opts.actuators, elapsed);
+    std::printf("%-22s %12zu (%.1f/s)\n", "samples sent", total.samples, total.samples / elapsed);
+    std::printf("%-22s %12lld (%.1f/s, %lld lost)\n", "samples stored", stored, stored / elapsed, static_cast<long long>(total.samples) - stored);
+    std::printf("%-22s %12zu (%.1f/s)\n", "events sent", total.events, total.events / elapsed);
+    std::printf("%-22s %12zu (%zu lost)\n", "pings", total.pings, total.lost);
+    std::printf("%-22s %12s %12s %12s %12s\n", "", "p50", "p90", "p99", "max");
+    std::printf("%-22s %12.0f %12.0f %12.0f %12.0f\n", "ack latency (us)", percentile(total.latencies_us, 0.5), percentile(total.latencies_us, 0.9),
+                percentile(total.latencies_us, 0.99), total.latencies_us.empty() ? 0.0 : total.latencies_us.back());
+    std::printf("%-22s %12lld (%.1f bytes/sample)\n", "db growth (bytes)", growth, stored > 0 ? double(growth) / stored : 0.0);
+
+    if(opts.pid){
+        std::printf("%-22s %12.1f%%\n", "server cpu", 100.0 * (cpu_after - cpu_before) / elapsed);
+    }
+
+    if(total.errors){
+        std::printf("%-22s %12zu\n", "errors", total.errors);
+    }
+
+    return total.errors ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+// Microbenchmarks of the ingest path: the dispatch of the text commands,
+// the evaluation of the rules of a sensor and the SQL helpers.
+
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/socket.h>
+
+// The server is not a library, its handlers are reached by including it
+#define main asgard_server_main
+#include "../src/server.cpp"
+#undef main
+
+namespace {
+
+const std::size_t iterations = 100000;
+
+template<typename Functor>
+double measure(std::size_t n, Functor functor){
+    auto start = std::chrono::steady_clock::now();
+
+    for(std::size_t i = 0; i < n; ++i){
+        functor(i);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / double(n);
+}
+
+void report(const char* name, double ns){
+    std::printf("%-40s %12.1f ns/op %12.0f op/s\n", name, ns, 1e9 / ns);
+}
+
+// Read the answers of the server so that its socket never fills up
+void drain(int fd){
+    char buffer[4096];
+    while(recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0){}
+}
+
+int answer_id(int fd){
+    char buffer[64];
+    auto n = recv(fd, buffer, sizeof(buffer) - 1, 0);
+
+    if(n <= 0){
+        return -1;
+    }
+
+    buffer[n] = '\0';
+    return std::atoi(buffer);
+}
+
+// A driver connected through a socket pair, as if accepted by the event loop
+int connect_driver(int& driver_fd){
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0){
+        return -1;
+    }
+
+    auto connection    = std::make_shared<connection_t>();
+    connection->socket = fds[0];
+    connection->input  = acquire_buffer();
+
+    {
+        std::lock_guard<std::mutex> l(connections_lock);
+        connections[fds[0]] = std::move(connection);
+    }
+
+    driver_fd = fds[1];
+    return fds[0];
+}
+
+void bench_commands(int server_fd, int driver_fd, int source_id, int sensor_id, int actuator_id){
+    std::vector<std::string> data;
+    for(std::size_t i = 0; i < 1000; ++i){
+        data.push_back("DATA " + std::to_string(source_id) + " " + std::to_string(sensor_id) + " " + std::to_string(20.0 + i % 100 / 10.0));
+    }
+
+    report("handle_command DATA", measure(iterations, [&](std::size_t i){
+        handle_command(data[i % data.size()].c_str(), server_fd);
+    }));
+
+    std::string event = "EVENT " + std::to_string(source_id) + " " + std::to_string(actuator_id) + " 1";
+
+    report("handle_command EVENT", measure(iterations, [&](std::size_t){
+        handle_command(event.c_str(), server_fd);
+    }));
+
+    report("handle_command PING", measure(iterations / 10, [&](std::size_t i){
+        handle_command("PING 42", server_fd);
+
+        if(i % 64 == 0){
+            drain(driver_fd);
+        }
+    }));
+
+    drain(driver_fd);
+}
+
+void bench_rules(std::size_t source_id, std::size_t sensor_id){
+    auto sensor = registry.sensor(source_id, sensor_id);
+
+    std::size_t inserted = 0;
+
+    for(std::size_t rules : {0, 1, 10, 100, 1000}){
+        // The conditions never match, only the evaluation is measured
+        for(; inserted < rules; ++inserted){
+            db_exec_dml(get_db(), "insert into condition(operator, value, fk_sensor) values (\">\", \"1000000\", %d);", sensor->id_sql);
+            db_exec_dml(get_db(), "insert into rule(value, fk_condition, fk_action, system_action) values (\"\", %d, 0, 0);", get_db().lastRowId());
+        }
+
+        reload_rules();
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "new_data (%zu rules)", rules);
+
+        report(name, measure(iterations, [&](std::size_t i){
+            // Bypass the minimum time between two samples of a sensor
+            sensor->last_event = std::chrono::milliseconds(0);
+            new_data(*sensor, 20.0 + i % 100 / 10.0);
+        }));
+    }
+}
+
+void bench_sql(){
+    auto& db = get_db();
+
+    db.execDML("create table if not exists bench(a integer, b text);");
+    db.execDML("begin transaction;");
+
+    report("db_exec_dml insert", measure(iterations, [&](std::size_t i){
+        db_exec_dml(db, "insert into bench(a, b) values (%d, \"%s\");", i, "value");
+    }));
+
+    report("execDML insert (compiled each time)", measure(iterations, [&](std::size_t i){
+        CppSQLite3Buffer sql;
+        db.execDML(sql.format("insert into bench(a, b) values (%d, %Q);", int(i), "value"));
+    }));
+
+    report("db_exec_scalar count", measure(iterations / 10, [&](std::size_t i){
+        db_exec_scalar(db, "select count(*) from bench where a = %d;", i);
+    }));
+
+    db.execDML("rollback transaction;");
+}
+
+} //end of anonymous namespace
+
+int main(){
+    // The database of the benchmark is created in a temporary directory
+    char directory[] = "/tmp/asgard_micro.XXXXXX";
+    if(!mkdtemp(directory) || chdir(directory) < 0){
+        std::perror("micro_bench: temporary directory");
+        return 1;
+    }
+
+    set_log_level(log_level::WARNING);
+
+    if(!db_connect(get_db())){
+        return 1;
+    }
+
+    reload_rules();
+
+    if(!start_db_writer(default_db_batch_size, default_db_batch_ms, iterations * 4)){
+        return 1;
+    }
+
+    start_executor(1, default_executor_shards, iterations * 4, parse_overflow_policy("drop_oldest"));
+
+    int driver_fd = -1;
+    int server_fd = connect_driver(driver_fd);
+    if(server_fd < 0){
+        std::perror("micro_bench: socketpair");
+        return 1;
+    }
+
+    handle_command("REG_SOURCE bench", server_fd);
+    auto source_id = answer_id(driver_fd);
+
+    handle_command(("REG_SENSOR " + std::to_string(source_id) + " TEMPERATURE bench_sensor").c_str(), server_fd);
+    auto sensor_id = answer_id(driver_fd);
+
+    handle_command(("REG_ACTUATOR " + std::to_string(source_id) + " bench_actuator").c_str(), server_fd);
+    auto actuator_id = answer_id(driver_fd);
+
+    if(source_id < 0 || sensor_id < 0 || actuator_id < 0){
+        std::fprintf(stderr, "micro_bench: registration failed\n");
+        return 1;
+    }
+
+    bench_commands(server_fd, driver_fd, source_id, sensor_id, actuator_id);
+
+    // The rules and the SQL helpers run alone on the database
+    stop_executor();
+    stop_db_writer();
+
+    bench_rules(source_id, sensor_id);
+    bench_sql();
+
+    for(auto file : {"asgard.db", "asgard.db-wal", "asgard.db-shm"}){
+        unlink(file);
+    }
+
+    return rmdir(directory);
+}
@@ -0,0 +1,497 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+// Replay of a capture of the driver traffic (see capture.hpp) against a
+// freshly started server, at the recorded pace, N times faster or as fast as
+// possible. The registrations are sent one at a time and wait for their
+// answer so that the server gives the same ids as during the capture. The
+// latency is measured with PING round trips on the text connections.
+//
+// The report is made of "key value" lines, passing the report of another
+// build with --baseline adds the relative difference of each value.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "capture.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+    std::string capture;
+    std::string host = "127.0.0.1";
+    int port         = 8083;
+    double speed     = 1.0;  ///< 1 replays at the recorded pace, 0 as fast as possible
+    std::size_t ping_ms = 100;  ///< Time between two pings of a text connection, 0 disables them
+    std::string baseline;
+};
+
+// A ping without answer after this time is lost
+const std::chrono::milliseconds ping_timeout(1000);
+
+// The registrations block the replay, a missing answer is an error
+const std::chrono::milliseconds registration_timeout(5000);
+
+struct connection {
+    int fd = -1;
+    bool binary = false;         ///< The frames are binary once the source is registered
+    bool binary_pending = false; ///< The pending registration switches to binary
+
+    bool registration_pending = false;
+    clock_type::time_point registration_time;
+
+    bool ping_pending = false;
+    std::size_t ping_token = 1;
+    clock_type::time_point ping_time;
+    clock_type::time_point next_ping;
+};
+
+struct replay_stats {
+    std::size_t connections = 0;
+    std::size_t messages    = 0;
+    std::size_t bytes       = 0;
+    std::size_t pings       = 0;
+    std::size_t lost        = 0;
+    std::size_t errors      = 0;
+    std::vector<double> registration_us;
+    std::vector<double> ping_us;
+};
+
+bool starts_with(const std::string& value, const char* prefix){
+    return value.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+bool ends_with(const std::string& value, const char* suffix){
+    auto n = std::strlen(suffix);
+    return value.size() >= n && value.compare(value.size() - n, n, suffix) == 0;
+}
+
+bool send_all(int fd, const char* data, std::size_t size){
+    while(size){
+        auto n = send(fd, data, size, MSG_NOSIGNAL);
+
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+
+        if(n <= 0){
+            return false;
+        }
+
+        data += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+int connect_driver(const options& opts){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port   = htons(opts.port);
+    inet_pton(AF_INET, opts.host.c_str(), &address.sin_addr);
+
+    if(connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0){
+        close(fd);
+        return -1;
+    }
+
+    // The text protocol reads one message per segment, do not merge them
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+bool is_registration(const std::string& message){
+    return starts_with(message, "REG_SOURCE") || starts_with(message, "REG_SENSOR")
+        || starts_with(message, "REG_ACTUATOR") || starts_with(message, "REG_ACTION");
+}
+
+void send_ping(connection& c, replay_stats& stats){
+    // The tokens are prefixed to be told apart from the ids of the registrations
+    auto message = "PING p" + std::to_string(c.ping_token);
+
+    // The answer can arrive before send returns
+    c.ping_time = clock_type::now();
+
+    if(send_all(c.fd, message.c_str(), message.size())){
+        c.ping_pending = true;
+        ++stats.pings;
+    } else {
+        ++stats.errors;
+    }
+}
+
+// Handle the answers of the server, the actions sent by the rules are ignored
+bool read_answers(connection& c, replay_stats& stats){
+    char buffer[4096];
+    auto n = recv(c.fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+
+    if(n < 0){
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    if(n == 0){
+        return false;
+    }
+
+    // The binary answers are not interpreted
+    if(c.binary){
+        return true;
+    }
+
+    buffer[n] = '\0';
+
+    auto now = clock_type::now();
+
+    if(c.registration_pending && buffer[0] >= '0' && buffer[0] <= '9'){
+        stats.registration_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - c.registration_time).count());
+        c.registration_pending = false;
+        c.binary = c.binary_pending;
+    }
+
+    auto token = "p" + std::to_string(c.ping_token);
+
+    // Answers of the lost pings arrive late, they are ignored
+    if(c.ping_pending && std::strstr(buffer, token.c_str())){
+        stats.ping_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - c.ping_time).count());
+        c.ping_pending = false;
+        ++c.ping_token;
+    }
+
+    return true;
+}
+
+double percentile(const std::vector<double>& sorted, double p){
+    if(sorted.empty()){
+        return 0.0;
+    }
+
+    auto rank = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+bool parse_options(int argc, char** argv, options& opts){
+    int i = 1;
+
+    for(; i + 1 < argc; i += 2){
+        std::string key   = argv[i];
+        std::string value = argv[i + 1];
+
+        if(key == "--host"){
+            opts.host = value;
+        } else if(key == "--port"){
+            opts.port = std::atoi(value.c_str());
+        } else if(key == "--speed"){
+            opts.speed = std::atof(value.c_str());
+        } else if(key == "--ping-ms"){
+            opts.ping_ms = std::strtoul(value.c_str(), nullptr, 10);
+        } else if(key == "--baseline"){
+            opts.baseline = value;
+        } else {
+            break;
+        }
+    }
+
+    // The capture file is the last argument
+    if(i + 1 != argc){
+        return false;
+    }
+
+    opts.capture = argv[i];
+    return opts.speed >= 0.0;
+}
+
+std::map<std::string, double> read_report(const std::string& path){
+    std::map<std::string, double> values;
+
+    std::ifstream file(path);
+    std::string line;
+
+    while(std::getline(file, line)){
+        if(line.empty() || line[0] == '#'){
+            continue;
+        }
+
+        std::istringstream line_ss(line);
+
+        std::string key;
+        double value;
+        if(line_ss >> key >> value){
+            values[key] = value;
+        }
+    }
+
+    return values;
+}
+
+} //end of anonymous namespace
+
+int main(int argc, char** argv){
+    options opts;
+
+    if(!parse_options(argc, argv, opts)){
+        std::cerr << "usage: replay [--host h] [--port p] [--speed n (0: maximum)] [--ping-ms ms (0: none)]" << std::endl
+                  << "              [--baseline previous_report] capture_file" << std::endl;
+        return 1;
+    }
+
+    capture_reader reader(opts.capture);
+
+    if(!reader.valid()){
+        std::cerr << "replay: " << opts.capture << " is not a capture file" << std::endl;
+        return 1;
+    }
+
+    std::unordered_map<std::size_t, connection> connections;
+    replay_stats stats;
+
+    capture_record record;
+    bool has_record = reader.next(record);
+    std::uint64_t capture_us = 0;
+
+    // The registrations are serialized, the source ids are global to the server
+    connection* registration = nullptr;
+
+    auto start = clock_type::now();
+    clock_type::time_point end;
+    bool draining = false;
+
+    std::vector<struct pollfd> poll_fds;
+    std::vector<connection*> poll_connections;
+
+    while(true){
+        auto now = clock_type::now();
+
+        if(registration && !registration->registration_pending){
+            registration = nullptr;
+        }
+
+        // Send all the records that are due
+        bool blocked = false;
+
+        while(has_record && !registration){
+            auto due = start + std::chrono::microseconds(opts.speed > 0.0 ? static_cast<long long>(record.time_us / opts.speed) : 0);
+
+            if(due > now){
+                break;
+            }
+
+            auto it = connections.find(record.connection);
+
+            if(record.kind == capture_kind::CONNECT){
+                connection c;
+                c.fd        = connect_driver(opts);
+                c.next_ping = now + std::chrono::milliseconds(opts.ping_ms);
+
+                if(c.fd < 0){
+                    std::perror("replay: connect");
+                    ++stats.errors;
+                } else {
+                    connections[record.connection] = c;
+                    ++stats.connections;
+                }
+            } else if(record.kind == capture_kind::DISCONNECT){
+                if(it != connections.end()){
+                    if(it->second.fd >= 0){
+                        close(it->second.fd);
+                    }
+
+                    connections.erase(it);
+                }
+            } else if(it != connections.end()){
+                auto& c = it->second;
+
+                // A registration and a ping are never mixed in the answers
+                if(c.ping_pending && record.kind == capture_kind::TEXT && is_registration(record.data)){
+                    blocked = true;
+                    break;
+                }
+
+                auto sent = clock_type::now();
+
+                if(!send_all(c.fd, record.data.data(), record.data.size())){
+                    ++stats.errors;
+                } else {
+                    ++stats.messages;
+                    stats.bytes += record.data.size();
+
+                    if(record.kind == capture_kind::TEXT && !c.binary && is_registration(record.data)){
+                        c.registration_pending = true;
+                        c.registration_time    = sent;
+                        c.binary_pending       = starts_with(record.data, "REG_SOURCE") && ends_with(record.data, " BINARY");
+                        registration           = &c;
+                    }
+                }
+            }
+
+            capture_us = record.time_us;
+            has_record = reader.next(record);
+        }
+
+        // Once the capture is sent, a last ping on each connection waits for the server to catch up
+        if(!has_record && !draining){
+            draining = true;
+
+            for(auto& entry : connections){
+                auto& c = entry.second;
+                if(!c.binary && !c.ping_pending && !c.registration_pending){
+                    send_ping(c, stats);
+                }
+            }
+        }
+
+        bool pending = false;
+
+        for(auto& entry : connections){
+            auto& c = entry.second;
+
+            if(c.ping_pending && now - c.ping_time > ping_timeout){
+                ++stats.lost;
+                ++c.ping_token;
+                c.ping_pending = false;
+            }
+
+            if(c.registration_pending && now - c.registration_time > registration_timeout){
+                std::cerr << "replay: registration without answer" << std::endl;
+                ++stats.errors;
+                c.registration_pending = false;
+            }
+
+            if(!draining && opts.ping_ms && !c.binary && !c.ping_pending && !c.registration_pending && c.next_ping <= now){
+                send_ping(c, stats);
+                c.next_ping = now + std::chrono::milliseconds(opts.ping_ms);
+            }
+
+            pending = pending || c.ping_pending || c.registration_pending;
+        }
+
+        if(draining && !pending){
+            end = clock_type::now();
+            break;
+        }
+
+        // Wait for the answers or the next record
+        auto wake = now + std::chrono::milliseconds(10);
+        if(has_record && !registration && !blocked && opts.speed > 0.0){
+            wake = std::min(wake, start + std::chrono::microseconds(static_cast<long long>(record.time_us / opts.speed)));
+        }
+
+        for(auto& entry : connections){
+            auto& c = entry.second;
+            if(!draining && opts.ping_ms && !c.binary && !c.ping_pending && !c.registration_pending){
+                wake = std::min(wake, c.next_ping);
+            }
+        }
+
+        auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake - clock_type::now()).count();
+
+        // At maximum speed, only the answers already there are read
+        if(has_record && !registration && !blocked && opts.speed == 0.0){
+            wait_ms = 0;
+        }
+
+        poll_fds.clear();
+        poll_connections.clear();
+
+        for(auto& entry : connections){
+            poll_fds.push_back({entry.second.fd, POLLIN, 0});
+            poll_connections.push_back(&entry.second);
+        }
+
+        if(poll(poll_fds.data(), poll_fds.size(), static_cast<int>(std::max<long long>(wait_ms, 0))) > 0){
+            for(std::size_t i = 0; i < poll_fds.size(); ++i){
+                auto& c = *poll_connections[i];
+
+                // The connection is kept closed until the end of the capture
+                if(poll_fds[i].revents && !read_answers(c, stats)){
+                    std::cerr << "replay: connection closed by the server" << std::endl;
+                    ++stats.errors;
+                    close(c.fd);
+                    c.fd = -1;
+                    c.registration_pending = false;
+                    c.ping_pending = false;
+                }
+            }
+        }
+    }
+
+    for(auto& entry : connections){
+        if(entry.second.fd >= 0){
+            close(entry.second.fd);
+        }
+    }
+
+    std::sort(stats.registration_us.begin(), stats.registration_us.end());
+    std::sort(stats.ping_us.begin(), stats.ping_us.end());
+
+    auto elapsed = std::chrono::duration<double>(end - start).count();
+
+    std::vector<std::pair<std::string, double>> report{
+        {"capture_s", capture_us / 1e6},
+        {"wall_s", elapsed},
+        {"speed", elapsed > 0.0 ? capture_us / 1e6 / elapsed : 0.0},
+        {"connections", double(stats.connections)},
+        {"messages", double(stats.messages)},
+        {"bytes", double(stats.bytes)},
+        {"messages_per_s", elapsed > 0.0 ? stats.messages / elapsed : 0.0},
+        {"registration_p50_us", percentile(stats.registration_us, 0.5)},
+        {"registration_p99_us", percentile(stats.registration_us, 0.99)},
+        {"pings", double(stats.pings)},
+        {"pings_lost", double(stats.lost)},
+        {"ping_p50_us", percentile(stats.ping_us, 0.5)},
+        {"ping_p90_us", percentile(stats.ping_us, 0.9)},
+        {"ping_p99_us", percentile(stats.ping_us, 0.99)},
+        {"ping_max_us", stats.ping_us.empty() ? 0.0 : stats.ping_us.back()},
+        {"errors", double(stats.errors)}};
+
+    auto baseline = opts.baseline.empty() ? std::map<std::string, double>() : read_report(opts.baseline);
+
+    std::printf("# %s, speed %s\n", opts.capture.c_str(), opts.speed > 0.0 ? std::to_string(opts.speed).c_str() : "maximum");
+
+    for(auto& entry : report){
+        auto it = baseline.find(entry.first);
+
+        if(it != baseline.end() && it->second != 0.0){
+            std::printf("%-22s %14.3f %14.3f %+8.1f%%\n", entry.first.c_str(), entry.second, it->second, 100.0 * (entry.second - it->second) / it->second);
+        } else if(it != baseline.end()){
+            std::printf("%-22s %14.3f %14.3f\n", entry.first.c_str(), entry.second, it->second);
+        } else {
+            std::printf("%-22s %14.3f\n", entry.first.c_str(), entry.second);
+        }
+    }
+
+    return stats.errors ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+/*
+ * Capture of the driver traffic
+ *
+ * The inbound messages are recorded at the boundary of the connection
+ * handler, to be replayed later against another build. File format:
+ *
+ *   "ASGCAP1\n" | u64 start (epoch us) | records...
+ *
+ *   record: u8 kind | varint delta (us since the previous record) | varint connection
+ *           [ | varint size | bytes ]    (TEXT and BINARY only)
+ *
+ * The integers are little-endian, the varints are LEB128. The connections
+ * are numbered from 1 in their order of acceptance, a TEXT record holds
+ * one message as read by the server, a BINARY record holds the bytes of
+ * one read (frames can be split between records).
+ */
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+enum class capture_kind : std::uint8_t {
+    CONNECT    = 1,
+    TEXT       = 2,
+    BINARY     = 3,
+    DISCONNECT = 4
+};
+
+/*!
+ * \brief Start recording into the given file (truncated).
+ *
+ * The capture functions must all be called from the event loop.
+ */
+bool start_capture(const std::string& path);
+
+/*!
+ * \brief Flush and close the capture file
+ */
+void stop_capture();
+
+/*!
+ * \brief Write the buffered records if the last flush is older than a second
+ */
+void flush_capture();
+
+bool capture_enabled();
+
+void capture_connect(int socket_fd);
+void capture_message(int socket_fd, const char* data, std::size_t size, bool binary);
+void capture_disconnect(int socket_fd);
+
+struct capture_record {
+    capture_kind kind;
+    std::uint64_t time_us;  ///< Time since the start of the capture
+    std::size_t connection;
+    std::string data;
+};
+
+/*!
+ * \brief Sequential reader of a capture file
+ */
+struct capture_reader {
+    explicit capture_reader(const std::string& path);
+    ~capture_reader();
+
+    capture_reader(const capture_reader&) = delete;
+    capture_reader& operator=(const capture_reader&) = delete;
+
+    /*!
+     * \brief Indicates if the file was opened and has a valid header
+     */
+    bool valid() const;
+
+    /*!
+     * \brief Read the next record, return false at the end or on a truncated record
+     */
+    bool next(capture_record& record);
+
+    std::uint64_t start_epoch_us() const;
+
+private:
+    std::FILE* file = nullptr;
+    std::uint64_t start_epoch = 0;
+    std::uint64_t time_us = 0;
+};
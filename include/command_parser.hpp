@@ -0,0 +1,48 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+
+/*!
+ * \brief A non-owning view over a token of a message
+ */
+struct token {
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    bool empty() const {
+        return !size;
+    }
+
+    bool operator==(const char* rhs) const {
+        return std::strlen(rhs) == size && std::memcmp(data, rhs, size) == 0;
+    }
+
+    std::string str() const {
+        return {data, size};
+    }
+};
+
+/*!
+ * \brief Split a null-terminated message into whitespace separated tokens,
+ * in place and without allocation
+ */
+struct tokenizer {
+    explicit tokenizer(const char* message);
+
+    token next();
+
+    bool next_id(std::size_t& value);
+    bool next_double(double& value, token& text);
+
+private:
+    const char* current;
+};
@@ -5,22 +5,108 @@
 //  http://opensource.org/licenses/MIT)
 //=======================================================================
 
+#pragma once
+
 #include <string>
-#include <iostream>
+#include <type_traits>
 
 #include "CppSQLite3.h"
 
+#include "logger.hpp"
+#include "metrics.hpp"
+
+/*!
+ * \brief Return the writer connection of the database.
+ *
+ * All the writes go through this connection, the pages should read through
+ * a db_reader instead.
+ */
 CppSQLite3DB& get_db();
 
+/*!
+ * \brief Scoped checkout of the read-only connection of the calling thread.
+ *
+ * The database is in WAL mode, a reader sees the last committed state and
+ * never waits behind the transaction of the writer. The connections are
+ * opened lazily, one per thread, and are owned by the pool. Handles can be
+ * nested on the same thread, they share the same connection. Before the
+ * database is connected, the handle falls back to the writer connection.
+ */
+struct db_reader {
+    db_reader();
+
+    db_reader(const db_reader&) = delete;
+    db_reader& operator=(const db_reader&) = delete;
+
+    CppSQLite3DB& db(){
+        return *connection;
+    }
+
+private:
+    CppSQLite3DB* connection;
+};
+
+struct db_reader_stats {
+    std::size_t connections; ///< Number of read-only connections opened
+    std::size_t checkouts;   ///< Number of handles checked out
+    std::size_t fallbacks;   ///< Number of handles served by the writer connection
+};
+
+db_reader_stats get_db_reader_stats();
+
+struct db_statement_stats {
+    std::size_t hits;     ///< Number of executions served by a cached statement
+    std::size_t misses;   ///< Number of statements compiled
+    std::size_t compiled; ///< Number of statements currently held by the calling thread
+};
+
+/*!
+ * \brief Return the compiled statement for the given query, ready to be bound.
+ *
+ * The printf-like placeholders (%d, %s, "%s") of the query are replaced by
+ * SQL parameters. Statements are cached per thread and per database, so
+ * the same query must not be nested inside an iteration of itself.
+ */
+CppSQLite3Statement& db_prepare(CppSQLite3DB& db, const std::string& query);
+
+db_statement_stats get_db_statement_stats();
+
+inline void db_bind(CppSQLite3Statement& statement, int i, const char* value){
+    statement.bind(i, value);
+}
+
+inline void db_bind(CppSQLite3Statement& statement, int i, const std::string& value){
+    statement.bind(i, value.c_str());
+}
+
+inline void db_bind(CppSQLite3Statement& statement, int i, double value){
+    statement.bind(i, value);
+}
+
+template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+void db_bind(CppSQLite3Statement& statement, int i, T value){
+    statement.bind(i, static_cast<long long>(value));
+}
+
+template<typename... T>
+void db_bind_all(CppSQLite3Statement& statement, T... args){
+    int i = 1;
+    int expand[] = {0, (db_bind(statement, i++, args), 0)...};
+    (void) expand;
+    (void) i;
+}
+
 template<typename... T>
 int db_exec_dml(CppSQLite3DB& db, const std::string& query, T... args){
+    static auto& latency = get_histogram("asgard_sql_duration_seconds", "Time to execute a SQL statement", "kind=\"dml\"");
+    latency_timer timer(latency);
+
     try {
-        CppSQLite3Buffer buffSQL;
-        buffSQL.format(query.c_str(), args...);
-        return db.execDML(buffSQL);
+        auto& statement = db_prepare(db, query);
+        db_bind_all(statement, args...);
+        return statement.execDML();
     } catch (CppSQLite3Exception& e) {
-        std::cerr << "asgard: SQL Query failed: " << e.errorCode() << ":" << e.errorMessage() << std::endl
-                  << "               query was: " << query << std::endl;
+        ASGARD_ERROR << "asgard: SQL Query failed: " << e.errorCode() << ":" << e.errorMessage() << ", query was: " << query;
     }
 
     return 0;
@@ -28,13 +114,22 @@ int db_exec_dml(CppSQLite3DB& db, const std::string& query, T... args){
 
 template<typename... T>
 int db_exec_scalar(CppSQLite3DB& db, const std::string& query, T... args){
+    static auto& latency = get_histogram("asgard_sql_duration_seconds", "Time to execute a SQL statement", "kind=\"scalar\"");
+    latency_timer timer(latency);
+
     try {
-        CppSQLite3Buffer buffSQL;
-        buffSQL.format(query.c_str(), args...);
-        return db.execScalar(buffSQL);
+        auto& statement = db_prepare(db, query);
+        db_bind_all(statement, args...);
+
+        auto result = statement.execQuery();
+
+        if (!result.eof() && result.numFields() > 0) {
+            return result.getIntField(0);
+        }
+
+        ASGARD_ERROR << "asgard: SQL Query failed: Invalid scalar query, query was: " << query;
     } catch (CppSQLite3Exception& e) {
-        std::cerr << "asgard: SQL Query failed: " << e.errorCode() << ":" << e.errorMessage() << std::endl
-                  << "               query was: " << query << std::endl;
+        ASGARD_ERROR << "asgard: SQL Query failed: " << e.errorCode() << ":" << e.errorMessage() << ", query was: " << query;
     }
 
     return -1;
@@ -42,13 +137,15 @@ int db_exec_scalar(CppSQLite3DB& db, const std::string& query, T... args){
 
 template<typename... T>
 CppSQLite3Query db_exec_query(CppSQLite3DB& db, const std::string& query, T... args){
+    static auto& latency = get_histogram("asgard_sql_duration_seconds", "Time to execute a SQL statement", "kind=\"query\"");
+    latency_timer timer(latency);
+
     try {
-        CppSQLite3Buffer buffSQL;
-        buffSQL.format(query.c_str(), args...);
-        return db.execQuery(buffSQL);
+        auto& statement = db_prepare(db, query);
+        db_bind_all(statement, args...);
+        return statement.execQuery();
     } catch (CppSQLite3Exception& e) {
-        std::cerr << "asgard: SQL Query failed: " << e.errorCode() << ":" << e.errorMessage() << std::endl
-                  << "               query was: " << query << std::endl;
+        ASGARD_ERROR << "asgard: SQL Query failed: " << e.errorCode() << ":" << e.errorMessage() << ", query was: " << query;
     }
 
     return {};
@@ -72,3 +169,11 @@ query_iterator end(CppSQLite3Query& query);
 
 void create_tables(CppSQLite3DB& db);
 bool db_connect(CppSQLite3DB& db);
+
+/*!
+ * \brief Open another read-write connection to the connected database.
+ *
+ * SQLite serializes the transactions of the connections, a connection
+ * waits for the lock of another one up to the busy timeout.
+ */
+bool db_open_writer(CppSQLite3DB& db);
@@ -0,0 +1,39 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+constexpr std::size_t max_sample_size = 31;
+
+struct db_writer_stats {
+    std::size_t queue_depth;    ///< Number of samples waiting to be written
+    std::size_t written;        ///< Number of samples committed since startup
+    std::size_t dropped;        ///< Number of samples dropped because the queue was full
+    std::size_t failed;         ///< Number of samples lost in a failed transaction
+    std::size_t batches;        ///< Number of committed transactions
+    std::size_t last_commit_us; ///< Duration of the last commit
+    std::size_t max_commit_us;  ///< Longest commit since startup
+};
+
+/*!
+ * \brief Start the thread writing the samples, on its own connection
+ */
+bool start_db_writer(std::size_t batch_size, std::size_t batch_ms, std::size_t max_queue);
+void stop_db_writer();
+
+/*!
+ * \brief Queue a sample, without allocation once the queue is warm.
+ * The values longer than max_sample_size are truncated. The value of a
+ * sensor is stored as given, the text is only kept as last value.
+ */
+bool push_sensor_data(std::size_t fk_sensor, double value, const char* data, std::size_t size);
+bool push_actuator_data(std::size_t fk_actuator, const char* data, std::size_t size);
+
+db_writer_stats get_db_writer_stats();
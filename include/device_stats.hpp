@@ -0,0 +1,42 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+
+#include "db.hpp"
+
+enum class device_kind {
+    SENSOR   = 0,
+    ACTUATOR = 1
+};
+
+/*!
+ * \brief Summary of all the values of a device, maintained on insert
+ */
+struct device_stats {
+    std::string last_value;
+    std::string last_time;
+    std::size_t count;
+    double min;
+    double max;
+    double sum;
+};
+
+void create_device_stats_tables(CppSQLite3DB& db);
+
+/*!
+ * \brief Account a new value, in the transaction inserting it
+ */
+void update_device_stats(CppSQLite3DB& db, device_kind kind, std::size_t fk_device, const char* value, const std::string& time);
+
+/*!
+ * \brief Get the summary of a device
+ * \return false if the device has no value
+ */
+bool get_device_stats(CppSQLite3DB& db, device_kind kind, std::size_t fk_device, device_stats& stats);
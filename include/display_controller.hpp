@@ -8,10 +8,13 @@
 #include <mongoose/Server.h>
 #include <mongoose/WebController.h>
 
+#include <ostream>
+
 struct display_controller : public Mongoose::WebController {
-    void display_menu(Mongoose::StreamResponse& response);
-    void display_sensors(Mongoose::StreamResponse& response);
-    void display_actuators(Mongoose::StreamResponse& response);
+    void display_menu(std::ostream& response);
+    void display_sensors(std::ostream& response);
+    void display_actuators(std::ostream& response);
+    void display_load_source(std::ostream& response);
     void display(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response);
     void led_on(Mongoose::Request& request, Mongoose::StreamResponse& response);
     void led_off(Mongoose::Request& request, Mongoose::StreamResponse& response);
@@ -19,9 +22,15 @@ struct display_controller : public Mongoose::WebController {
     void sensor_script(Mongoose::Request& request, Mongoose::StreamResponse& response);
     void actuator_data(Mongoose::Request& request, Mongoose::StreamResponse& response);
     void actuator_script(Mongoose::Request& request, Mongoose::StreamResponse& response);
+    void sensor_history_api(Mongoose::Request& request, Mongoose::StreamResponse& response);
+    void actuator_history_api(Mongoose::Request& request, Mongoose::StreamResponse& response);
+    void retention_api(Mongoose::Request& request, Mongoose::StreamResponse& response);
+    void metrics(Mongoose::Request& request, Mongoose::StreamResponse& response);
+    void events(Mongoose::Request& request, Mongoose::StreamResponse& response);
     void display_actions(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response);
     void display_rules(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response);
     void action(Mongoose::Request& request, Mongoose::StreamResponse& response);
     void add_rule(Mongoose::Request& request, Mongoose::StreamResponse& response);
+    void cancel_delayed(Mongoose::Request& request, Mongoose::StreamResponse& response);
     void setup();
 };
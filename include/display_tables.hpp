@@ -0,0 +1,24 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <ostream>
+
+#include "CppSQLite3.h"
+
+/*!
+ * \brief Render the rows of the table of rules.
+ *
+ * A single joined query is used, the rendering is linear in the number of rules.
+ */
+void display_rules_table(CppSQLite3DB& db, std::ostream& response);
+
+/*!
+ * \brief Render the forms of the available actions, with a single joined query
+ */
+void display_actions_list(CppSQLite3DB& db, std::ostream& response);
@@ -0,0 +1,90 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <cstddef>
+
+#include "db_writer.hpp"
+
+/*
+ * Broadcast of the live updates to the web clients
+ *
+ * The event loop publishes one compact event per DATA and EVENT into a
+ * single ring shared by all the subscribers. A subscriber only holds the id
+ * of the last event it has seen. A subscriber too slow to read the events
+ * before the ring overwrites them is evicted: it is told to reload its state
+ * instead of being given an incomplete stream.
+ */
+
+enum class stream_kind : std::uint8_t {
+    SENSOR,
+    ACTUATOR
+};
+
+struct stream_event {
+    std::uint64_t id;
+    stream_kind kind;
+    std::size_t device; ///< pk of the sensor or of the actuator
+    std::time_t time;
+    std::size_t size;
+    char value[max_sample_size + 1]; ///< Value as received, null-terminated
+};
+
+/*!
+ * \brief The devices a subscriber wants, all of them when both lists are empty
+ */
+struct stream_filter {
+    std::vector<std::size_t> sensors;
+    std::vector<std::size_t> actuators;
+
+    bool accepts(const stream_event& event) const;
+};
+
+struct stream_batch {
+    bool evicted = false;     ///< The events after the cursor were overwritten
+    std::uint64_t last_id = 0; ///< Cursor to resume from, including the filtered events
+    std::vector<stream_event> events;
+};
+
+struct event_stream_stats {
+    std::size_t published; ///< Number of events published since startup
+    std::size_t waiting;   ///< Number of subscribers waiting for events
+    std::size_t evicted;   ///< Number of subscribers evicted because they were too slow
+};
+
+constexpr std::size_t event_stream_capacity = 4096;
+
+/*!
+ * \brief Set the time a subscriber waits for an event and the maximum number
+ * of subscribers waiting at the same time (the others are answered at once).
+ *
+ * A waiting subscriber blocks the thread of the web server serving it, so
+ * the maximum must stay well below the number of threads of the web server.
+ */
+void configure_event_stream(std::chrono::milliseconds hold, std::size_t max_waiting);
+
+/*!
+ * \brief Publish an event, must be cheap: called from the event loop
+ */
+void publish_event(stream_kind kind, std::size_t device, const char* value, std::size_t size);
+
+/*!
+ * \brief Return the id of the last published event
+ */
+std::uint64_t last_event_id();
+
+/*!
+ * \brief Read the events after the given id, waiting for one if there are none yet
+ */
+void wait_events(std::uint64_t after, const stream_filter& filter, std::size_t max_events, stream_batch& batch);
+
+event_stream_stats get_event_stream_stats();
@@ -0,0 +1,54 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <cstddef>
+
+/*!
+ * \brief What to do when the queue of a shard is full
+ */
+enum class overflow_policy {
+    DROP_NEWEST, ///< Reject the new task
+    DROP_OLDEST, ///< Discard the oldest pending task of the shard
+    BLOCK        ///< Wait until the shard has room (see try_execute_task)
+};
+
+struct executor_stats {
+    std::size_t queue_depth;     ///< Number of pending tasks
+    std::size_t executed;        ///< Number of tasks executed since startup
+    std::size_t dropped;         ///< Number of tasks dropped by the overflow policy
+    std::size_t stolen;          ///< Number of tasks executed outside of their home worker
+    std::size_t last_latency_us; ///< Time between submission and completion of the last task
+    std::size_t max_latency_us;  ///< Longest latency since startup
+};
+
+overflow_policy parse_overflow_policy(const std::string& policy);
+
+/*!
+ * \brief Start the executor.
+ *
+ * Tasks are sharded by key: the tasks of one key are always executed one
+ * after another, in submission order. Idle workers steal work from the
+ * shards that are not being executed.
+ */
+void start_executor(std::size_t workers, std::size_t shards, std::size_t capacity, overflow_policy policy);
+void stop_executor();
+
+bool execute_task(std::size_t key, std::function<void()> task);
+
+/*!
+ * \brief Submit a task without ever waiting for room, for the event loop.
+ *
+ * With the BLOCK policy, the task is rejected when its shard is full, like
+ * with DROP_NEWEST, so that a slow shard never stalls the other connections.
+ */
+bool try_execute_task(std::size_t key, std::function<void()> task);
+
+executor_stats get_executor_stats();
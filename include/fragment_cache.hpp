@@ -0,0 +1,33 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <ostream>
+
+/*!
+ * \brief Invalidate all the rendered fragments.
+ *
+ * Must be called when the devices shown on the pages change (registration
+ * or first value of a device).
+ */
+void invalidate_fragments();
+
+/*!
+ * \brief Return a tag identifying the current version of the fragments,
+ * unique across restarts, usable as an HTTP ETag
+ */
+std::string fragments_etag();
+
+/*!
+ * \brief Return the cached fragment with the given name, rendering it first
+ * if it is missing or older than the last invalidation.
+ */
+std::shared_ptr<const std::string> cached_fragment(const std::string& name, const std::function<void(std::ostream&)>& render);
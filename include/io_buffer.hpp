@@ -0,0 +1,71 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstddef>
+
+/*!
+ * \brief Growable byte storage of a connection
+ */
+struct io_buffer {
+    std::vector<char> data;
+    std::size_t offset = 0; ///< Bytes already consumed
+};
+
+struct io_buffer_releaser {
+    void operator()(io_buffer* buffer) const;
+};
+
+/*!
+ * \brief A buffer given back to the pool when released
+ */
+using pooled_buffer = std::unique_ptr<io_buffer, io_buffer_releaser>;
+
+/*!
+ * \brief Get an empty buffer, reusing the storage of a released one.
+ *
+ * The pool is per thread, acquiring and releasing never takes a lock.
+ */
+pooled_buffer acquire_buffer();
+
+/*!
+ * \brief The outbound messages of one connection, flushed with writev.
+ *
+ * The queue is not thread-safe, the connection must lock it.
+ */
+struct send_queue {
+    static constexpr std::size_t max_bytes = 64 * 1024;
+
+    enum class status {
+        FLUSHED, ///< Everything has been written
+        PENDING, ///< The socket is full, wait until it is writable again
+        FAILED   ///< The socket is broken
+    };
+
+    /*!
+     * \brief Copy a message at the end of the queue
+     * \return false if the queue is full
+     */
+    bool push(const char* data, std::size_t size);
+
+    /*!
+     * \brief Write as much as possible of the queue to the (non-blocking) socket
+     */
+    status flush(int socket_fd);
+
+    bool empty() const {
+        return pending.empty();
+    }
+
+private:
+    std::deque<pooled_buffer> pending;
+    std::size_t bytes = 0;
+};
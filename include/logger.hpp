@@ -0,0 +1,130 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+/*
+ * Asynchronous logging
+ *
+ * The producers format a record on their stack and copy it into the ring
+ * of their thread, without lock and without flushing. A background thread
+ * drains the rings and writes the records in order. When the ring of a
+ * thread is full, the record is dropped and counted, the producer never
+ * waits for the console.
+ */
+
+#include <string>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+enum class log_level : std::uint8_t {
+    DEBUG   = 0,
+    INFO    = 1,
+    WARNING = 2,
+    ERROR   = 3,
+    NONE    = 4
+};
+
+// The records below this level are removed at compile time
+#ifndef ASGARD_LOG_LEVEL
+#define ASGARD_LOG_LEVEL 0
+#endif
+
+constexpr log_level compile_log_level = static_cast<log_level>(ASGARD_LOG_LEVEL);
+
+constexpr std::size_t max_log_message = 240;
+
+/*!
+ * \brief Set the level below which the records are ignored at run time
+ */
+void set_log_level(log_level level);
+
+/*!
+ * \brief Parse a level name (debug, info, warning, error, none)
+ */
+log_level parse_log_level(const std::string& level, log_level default_level);
+
+bool log_enabled_at_runtime(log_level level);
+
+inline bool log_enabled(log_level level){
+    return level >= compile_log_level && log_enabled_at_runtime(level);
+}
+
+/*!
+ * \brief Start the thread writing the records, must be called once
+ */
+void start_logger();
+
+/*!
+ * \brief Write the pending records and stop the thread
+ */
+void stop_logger();
+
+/*!
+ * \brief Return the number of records dropped because a ring was full
+ */
+std::size_t get_log_dropped();
+
+/*!
+ * \brief A record being formatted, queued on destruction.
+ *
+ * The messages longer than max_log_message are truncated.
+ */
+struct log_line {
+    explicit log_line(log_level level) : level(level) {}
+
+    log_line(const log_line&) = delete;
+    log_line& operator=(const log_line&) = delete;
+
+    ~log_line();
+
+    log_line& write(const char* data, std::size_t n);
+
+    log_line& operator<<(const char* value){
+        return write(value, std::char_traits<char>::length(value));
+    }
+
+    log_line& operator<<(const std::string& value){
+        return write(value.data(), value.size());
+    }
+
+    log_line& operator<<(char value){
+        return write(&value, 1);
+    }
+
+    log_line& operator<<(double value){
+        char buffer[32];
+        return write(buffer, std::snprintf(buffer, sizeof(buffer), "%g", value));
+    }
+
+    template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    log_line& operator<<(T value){
+        char buffer[32];
+        return write(buffer, std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value)));
+    }
+
+    template<typename T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, int>::type = 0>
+    log_line& operator<<(T value){
+        char buffer[32];
+        return write(buffer, std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value)));
+    }
+
+private:
+    log_level level;
+    std::size_t size = 0;
+    char message[max_log_message];
+};
+
+// The arguments are not evaluated when the level is disabled
+#define ASGARD_LOG(level) if (!log_enabled(level)) {} else log_line(level)
+
+#define ASGARD_DEBUG ASGARD_LOG(log_level::DEBUG)
+#define ASGARD_INFO ASGARD_LOG(log_level::INFO)
+#define ASGARD_WARNING ASGARD_LOG(log_level::WARNING)
+#define ASGARD_ERROR ASGARD_LOG(log_level::ERROR)
@@ -0,0 +1,111 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+/*!
+ * \brief A monotonic counter, updated without lock
+ */
+struct metric_counter {
+    std::atomic<std::uint64_t> value{0};
+
+    void inc(std::uint64_t n = 1){
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+/*!
+ * \brief A value going up and down, updated without lock
+ */
+struct metric_gauge {
+    std::atomic<std::int64_t> value{0};
+
+    void set(std::int64_t v){
+        value.store(v, std::memory_order_relaxed);
+    }
+
+    void inc(std::int64_t n = 1){
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void dec(std::int64_t n = 1){
+        value.fetch_sub(n, std::memory_order_relaxed);
+    }
+};
+
+// Upper bounds (in microseconds) of the latency buckets, from 50us to 10s
+constexpr std::size_t latency_buckets = 16;
+extern const std::uint64_t latency_bounds_us[latency_buckets];
+
+/*!
+ * \brief A latency histogram with fixed buckets, updated without lock.
+ *
+ * The quantiles (p50, p99) are computed by the scraper from the buckets.
+ */
+struct metric_histogram {
+    std::atomic<std::uint64_t> buckets[latency_buckets + 1]; ///< The last bucket is +Inf
+    std::atomic<std::uint64_t> sum_us{0};
+
+    metric_histogram();
+
+    void observe(std::uint64_t duration_us);
+};
+
+/*!
+ * \brief Record the time between its construction and its destruction
+ */
+struct latency_timer {
+    metric_histogram& histogram;
+    std::chrono::steady_clock::time_point start_time;
+
+    explicit latency_timer(metric_histogram& histogram) : histogram(histogram), start_time(std::chrono::steady_clock::now()) {}
+
+    latency_timer(const latency_timer&) = delete;
+    latency_timer& operator=(const latency_timer&) = delete;
+
+    ~latency_timer(){
+        auto end_time = std::chrono::steady_clock::now();
+        histogram.observe(std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count());
+    }
+};
+
+/*!
+ * \brief Return the counter with the given name and labels, registering it on first use.
+ *
+ * The registration takes a lock, the callers should keep the reference
+ * (e.g. in a static) instead of looking the metric up on each update. The
+ * labels are written as is between braces (e.g. route="home").
+ */
+metric_counter& get_counter(const std::string& name, const std::string& help, const std::string& labels = "");
+
+/*!
+ * \brief Return the gauge with the given name and labels, registering it on first use.
+ */
+metric_gauge& get_gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+
+/*!
+ * \brief Return the histogram with the given name and labels, registering it on first use.
+ *
+ * The name should end with _seconds, the values are exported in seconds.
+ */
+metric_histogram& get_histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+/*!
+ * \brief Write all the registered metrics in the Prometheus text format
+ */
+void write_metrics(std::ostream& out);
+
+/*!
+ * \brief Write a single sample of a metric not held by the registry
+ */
+void write_metric(std::ostream& out, const char* name, const char* type, const char* help, double value);
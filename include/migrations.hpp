@@ -0,0 +1,40 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include "db.hpp"
+
+/*!
+ * \brief Apply, in order, the migrations not yet recorded in the schema_version table.
+ *
+ * Each migration runs in its own transaction, a failed migration is rolled
+ * back and stops the upgrade.
+ *
+ * \return true if the schema is up to date
+ */
+bool run_migrations(CppSQLite3DB& db);
+
+/*!
+ * \brief Return the version of the schema of the database
+ */
+std::size_t schema_version(CppSQLite3DB& db);
+
+/*!
+ * \brief Move one batch of the legacy text history of the sensors into the
+ * typed sensor_value table, the most recent values first.
+ *
+ * The batch is moved in a single transaction, so that the conversion can be
+ * interleaved with the ingest.
+ *
+ * A batch with a value that cannot be copied (its time collides with an
+ * existing value) is rolled back, the legacy rows are kept and the
+ * conversion stops.
+ *
+ * \return The number of values moved, 0 once the legacy table is empty or on failure
+ */
+std::size_t migrate_sensor_data_batch(CppSQLite3DB& db, std::size_t batch_size);
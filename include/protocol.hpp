@@ -0,0 +1,108 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+/*
+ * Binary variant of the driver protocol
+ *
+ * A driver selects it by registering with "REG_SOURCE <name> BINARY". The
+ * answer to REG_SOURCE is still sent as text, every following message in
+ * both directions is a binary frame. The driver must wait for the id before
+ * it sends its first frame (the server only accepts the frames read with
+ * the registration when they directly follow "BINARY"):
+ *
+ *   u16 size | u8 command | payload (size - 1 bytes)
+ *
+ * All integers are little-endian, ids are u32, values are IEEE 754
+ * doubles and strings are a u16 length followed by the bytes. Payloads:
+ *
+ *   UNREG_SOURCE    u32 source
+ *   REG_SENSOR      u32 source, str type, str name   -> ID u32 sensor
+ *   UNREG_SENSOR    u32 source, u32 sensor
+ *   REG_ACTUATOR    u32 source, str name             -> ID u32 actuator
+ *   UNREG_ACTUATOR  u32 source, u32 actuator
+ *   REG_ACTION      u32 source, str type, str name   -> ID u32 action
+ *   UNREG_ACTION    u32 source, u32 action
+ *   DATA            u32 source, u32 sensor, f64 value
+ *   EVENT           u32 source, u32 actuator, str value
+ *   ACTION          str name, str value (server to driver)
+ */
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+enum class binary_command : std::uint8_t {
+    UNREG_SOURCE   = 1,
+    REG_SENSOR     = 2,
+    UNREG_SENSOR   = 3,
+    REG_ACTUATOR   = 4,
+    UNREG_ACTUATOR = 5,
+    REG_ACTION     = 6,
+    UNREG_ACTION   = 7,
+    DATA           = 8,
+    EVENT          = 9,
+    ACTION         = 10,
+    ID             = 11
+};
+
+/*!
+ * \brief Return the name of the command (the same as in the text protocol)
+ */
+const char* binary_command_name(std::uint8_t command);
+
+constexpr std::size_t frame_header_size = 2;
+constexpr std::size_t max_frame_size    = 4096;
+
+/*!
+ * \brief Return the size announced by the header of the frame at the
+ * beginning of the buffer, or 0 if the header is not complete
+ */
+std::size_t declared_frame_size(const char* data, std::size_t size);
+
+/*!
+ * \brief Return the size of the complete frame at the beginning of the
+ * buffer, or 0 if more data is needed
+ */
+std::size_t complete_frame_size(const char* data, std::size_t size);
+
+/*!
+ * \brief Sequential reader over the payload of a frame
+ */
+struct frame_reader {
+    frame_reader(const char* data, std::size_t size);
+
+    bool read_u8(std::uint8_t& value);
+    bool read_u32(std::uint32_t& value);
+    bool read_f64(double& value);
+    bool read_string(std::string& value);
+
+private:
+    const char* data;
+    std::size_t size;
+    std::size_t position = 0;
+};
+
+/*!
+ * \brief Build a frame into a buffer
+ */
+struct frame_writer {
+    explicit frame_writer(binary_command command);
+
+    void write_u32(std::uint32_t value);
+    void write_f64(double value);
+    void write_string(const std::string& value);
+
+    /*!
+     * \brief Complete the header and return the frame
+     */
+    const std::string& frame();
+
+private:
+    std::string buffer;
+};
@@ -0,0 +1,106 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+
+struct sample_buffer;
+
+struct sensor_t {
+    std::size_t id;
+    std::string type;
+    std::string name;
+
+    std::size_t id_sql;
+    std::chrono::milliseconds last_event;
+
+    bool first;
+    double last_value;
+
+    std::shared_ptr<sample_buffer> history;
+};
+
+struct action_t {
+    std::size_t id;
+    std::string type;
+    std::string name;
+};
+
+struct actuator_t {
+    std::size_t id;
+    std::string name;
+
+    std::size_t id_sql;
+    std::chrono::milliseconds last_event;
+
+    std::shared_ptr<sample_buffer> history;
+};
+
+struct source_t {
+    std::size_t id;
+    std::string name;
+
+    std::size_t id_sql;
+    std::size_t sensors_counter;
+    std::size_t actuators_counter;
+    std::size_t actions_counter;
+
+    int socket;
+
+    std::unordered_map<std::size_t, std::shared_ptr<sensor_t>> sensors;
+    std::unordered_map<std::size_t, std::shared_ptr<actuator_t>> actuators;
+    std::unordered_map<std::size_t, std::shared_ptr<action_t>> actions;
+};
+
+/*!
+ * \brief Registry of the live sources and of their devices.
+ *
+ * All the lookups are hash-based. The records are shared, their address
+ * never changes and they stay valid for the users still holding them after
+ * unregistration. The lookups return nullptr when the record does not exist.
+ */
+struct device_registry {
+    std::shared_ptr<source_t> add_source(const std::string& name, int socket);
+    void set_source_sql(source_t& source, std::size_t id_sql);
+    bool remove_source(std::size_t source_id);
+
+    /*!
+     * \brief Remove all the sources of a socket, return their ids
+     */
+    std::vector<std::size_t> remove_sources(int socket);
+
+    std::shared_ptr<source_t> source(std::size_t source_id) const;
+    std::shared_ptr<source_t> source_from_sql(std::size_t id_sql) const;
+
+    std::shared_ptr<sensor_t> add_sensor(source_t& source);
+    std::shared_ptr<actuator_t> add_actuator(source_t& source);
+    std::shared_ptr<action_t> add_action(source_t& source);
+
+    bool remove_sensor(std::size_t source_id, std::size_t sensor_id);
+    bool remove_actuator(std::size_t source_id, std::size_t actuator_id);
+    bool remove_action(std::size_t source_id, std::size_t action_id);
+
+    std::shared_ptr<sensor_t> sensor(std::size_t source_id, std::size_t sensor_id) const;
+    std::shared_ptr<actuator_t> actuator(std::size_t source_id, std::size_t actuator_id) const;
+
+    std::size_t sources() const;
+
+private:
+    mutable std::mutex lock;
+
+    std::size_t current_source = 0;
+
+    std::unordered_map<std::size_t, std::shared_ptr<source_t>> by_id;
+    std::unordered_map<std::size_t, std::shared_ptr<source_t>> by_sql;
+};
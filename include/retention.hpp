@@ -0,0 +1,51 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <cstddef>
+
+#include "db.hpp"
+
+/*!
+ * \brief How long the data is kept, in days (0 to keep it forever)
+ */
+struct retention_config {
+    std::size_t raw_days;      ///< Raw sensor values, for the types without their own policy
+    std::size_t rollup_days;   ///< Sensor rollups, of all resolutions
+    std::size_t actuator_days; ///< Actuator events
+
+    std::unordered_map<std::string, std::size_t> raw_days_by_type; ///< Raw sensor values, by (upper-case) sensor type
+
+    std::size_t interval_s;   ///< Time between two pruning passes
+    std::size_t batch_size;   ///< Maximum number of rows deleted in one step
+    std::size_t vacuum_pages; ///< Maximum number of pages given back after one step
+};
+
+struct retention_stats {
+    std::size_t passes;          ///< Number of complete pruning passes
+    std::size_t deleted_rows;    ///< Number of rows deleted since startup
+    std::size_t reclaimed_bytes; ///< Bytes given back to the file system since startup
+    std::size_t last_pass_ms;    ///< Duration of the last complete pass (sum of its steps)
+    std::size_t max_step_ms;     ///< Longest step since startup
+};
+
+void configure_retention(const retention_config& config);
+
+/*!
+ * \brief Execute one bounded step of the pruning pass, starting a new pass when due.
+ *
+ * Must be called from the thread writing into the database, between two
+ * transactions.
+ *
+ * \return true if the current pass has more work
+ */
+bool prune_step(CppSQLite3DB& db);
+
+retention_stats get_retention_stats();
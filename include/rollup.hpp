@@ -0,0 +1,28 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <vector>
+#include <ctime>
+
+#include "db.hpp"
+
+/*!
+ * \brief Resolutions (in seconds) of the sensor rollups, from the finest
+ */
+extern const std::vector<std::size_t> rollup_resolutions;
+
+void create_rollup_tables(CppSQLite3DB& db);
+void update_rollups(CppSQLite3DB& db, std::size_t fk_sensor, std::time_t time, double value);
+
+/*!
+ * \brief Return the coarsest resolution giving at least the given number of points
+ * over the given duration, or 0 if the raw data should be used. The durations
+ * above 48 hours use at least the hourly rollup.
+ */
+std::size_t select_rollup_resolution(std::size_t seconds, std::size_t points);
@@ -0,0 +1,66 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstddef>
+
+enum class rule_operator {
+    EQUALS,
+    NOT_EQUALS,
+    GREATER,
+    GREATER_EQUALS,
+    LESS,
+    LESS_EQUALS
+};
+
+/*!
+ * \brief A rule joined with its condition, ready to be evaluated
+ */
+struct compiled_rule {
+    std::size_t pk_rule;
+    std::size_t fk_action;
+    std::size_t system_action;
+    std::string value;
+
+    rule_operator op;
+    bool once;        ///< Only trigger when the condition becomes true
+    double threshold; ///< The condition value
+};
+
+/*!
+ * \brief Immutable index of all the rules by sensor and actuator
+ */
+struct rule_index {
+    std::unordered_map<std::size_t, std::vector<compiled_rule>> sensor_rules;
+    std::unordered_map<std::size_t, std::vector<compiled_rule>> actuator_rules;
+    std::unordered_map<std::size_t, const compiled_rule*> rules;
+
+    const std::vector<compiled_rule>& sensor(std::size_t fk_sensor) const;
+    const std::vector<compiled_rule>& actuator(std::size_t fk_actuator) const;
+    const compiled_rule* find(std::size_t pk_rule) const;
+};
+
+bool parse_rule_operator(const std::string& op, rule_operator& result, bool& once);
+bool rule_matches(const compiled_rule& rule, double value, double last_value, bool first);
+
+void execute_rule(const compiled_rule& rule);
+
+/*!
+ * \brief Execute a sequence of rules in order.
+ *
+ * A sleep system action does not block: the rest of the sequence is
+ * scheduled as a continuation.
+ */
+void run_rules(const std::vector<std::size_t>& sequence);
+
+void reload_rules();
+std::shared_ptr<const rule_index> get_rules();
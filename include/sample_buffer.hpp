@@ -0,0 +1,50 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <ctime>
+
+/*!
+ * \brief Fixed-capacity ring buffer of the most recent samples of a device.
+ *
+ * Times and values are kept in parallel arrays so that a range can be
+ * copied directly into the chart output.
+ */
+struct sample_buffer {
+    static constexpr std::size_t capacity = 512;
+
+    void push(std::time_t time, double value, const char* raw, std::size_t size);
+
+    bool empty() const;
+    bool latest(std::string& raw) const;
+
+    /*!
+     * \brief Indicates if the buffer holds all the samples since the given time
+     */
+    bool covers(std::time_t from) const;
+
+    /*!
+     * \brief Append the samples more recent than the given time, oldest first
+     */
+    std::size_t copy_since(std::time_t from, std::vector<std::time_t>& times, std::vector<double>& values) const;
+
+private:
+    mutable std::mutex lock;
+
+    std::array<std::time_t, capacity> times;
+    std::array<double, capacity> values;
+
+    std::size_t head  = 0; ///< Next position to write
+    std::size_t count = 0;
+
+    std::string last_raw; ///< Last value exactly as received
+};
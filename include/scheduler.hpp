@@ -0,0 +1,35 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <vector>
+#include <ctime>
+#include <cstddef>
+
+#include "db.hpp"
+
+/*!
+ * \brief The continuation of a rule sequence, waiting for its delay
+ */
+struct delayed_rules {
+    std::size_t id;
+    std::time_t due;
+    std::vector<std::size_t> rules; ///< pk of the rules still to execute, in order
+};
+
+void create_scheduler_tables(CppSQLite3DB& db);
+
+/*!
+ * \brief Start the scheduler, rescheduling the continuations persisted before a restart
+ */
+void start_scheduler();
+void stop_scheduler();
+
+std::size_t schedule_rules(std::size_t delay_s, const std::vector<std::size_t>& rules);
+bool cancel_delayed_rules(std::size_t id);
+std::vector<delayed_rules> list_delayed_rules();
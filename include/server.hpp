@@ -5,10 +5,20 @@
 //  http://opensource.org/licenses/MIT)
 //=======================================================================
 
+#pragma once
+
+#include<string>
+#include<memory>
+
 #include<sys/socket.h>
 #include<sys/un.h>
 
+struct sample_buffer;
+
 bool source_sql_exists(std::size_t source_id);
 int source_addr_from_sql(int id_sql);
 
 bool send_to_driver(int client_address, const std::string& message);
+
+std::shared_ptr<const sample_buffer> sensor_history(std::size_t sensor_pk);
+std::shared_ptr<const sample_buffer> actuator_history(std::size_t actuator_pk);
@@ -0,0 +1,52 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*!
+ * \brief Hierarchical timer wheel.
+ *
+ * Each level has 64 slots, a slot of level L covering 64^L ticks. Adding
+ * a timer is O(1) and a tick only touches one slot (plus the occasional
+ * cascade of a higher level slot). The wheel is not thread-safe.
+ */
+struct timer_wheel {
+    static constexpr std::size_t levels    = 4;
+    static constexpr std::size_t slot_bits = 6;
+    static constexpr std::size_t slots     = 1 << slot_bits;
+
+    explicit timer_wheel(std::uint64_t now);
+
+    void add(std::uint64_t id, std::uint64_t expires);
+
+    /*!
+     * \brief Advance the wheel up to the given tick and collect the expired timers
+     */
+    void advance(std::uint64_t now, std::vector<std::uint64_t>& expired);
+
+    std::size_t size() const;
+
+private:
+    struct entry {
+        std::uint64_t id;
+        std::uint64_t expires;
+    };
+
+    void place(entry e);
+    void cascade(std::size_t level);
+    void tick(std::vector<std::uint64_t>& expired);
+
+    std::array<std::array<std::vector<entry>, slots>, levels> wheel;
+
+    std::uint64_t current; ///< Last processed tick
+    std::size_t count = 0;
+};
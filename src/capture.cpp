@@ -0,0 +1,256 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+
+#include "capture.hpp"
+
+namespace {
+
+const char magic[] = "ASGCAP1\n";
+constexpr std::size_t magic_size = sizeof(magic) - 1;
+
+// The records are buffered, the event loop flushes them every second
+constexpr std::size_t file_buffer_size = 64 * 1024;
+const std::chrono::seconds flush_interval(1);
+
+using clock_type = std::chrono::steady_clock;
+
+std::FILE* capture_file = nullptr;
+
+clock_type::time_point start_time;
+clock_type::time_point last_flush;
+std::uint64_t last_time_us = 0;
+bool pending = false; ///< Records not yet flushed
+
+// The file descriptors are reused, the connections are numbered instead
+std::size_t next_connection = 1;
+std::unordered_map<int, std::size_t> connection_ids;
+
+void write_varint(std::uint64_t value){
+    unsigned char buffer[10];
+    std::size_t size = 0;
+
+    do {
+        buffer[size] = value & 0x7F;
+        value >>= 7;
+
+        if(value){
+            buffer[size] |= 0x80;
+        }
+
+        ++size;
+    } while(value);
+
+    std::fwrite(buffer, 1, size, capture_file);
+}
+
+bool read_varint(std::FILE* file, std::uint64_t& value){
+    value = 0;
+
+    for(std::size_t shift = 0; shift < 64; shift += 7){
+        auto byte = std::fgetc(file);
+
+        if(byte == EOF){
+            return false;
+        }
+
+        value |= std::uint64_t(byte & 0x7F) << shift;
+
+        if(!(byte & 0x80)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void write_header(capture_kind kind, std::size_t connection){
+    auto now     = clock_type::now();
+    auto time_us = std::chrono::duration_cast<std::chrono::microseconds>(now - start_time).count();
+
+    std::fputc(static_cast<int>(kind), capture_file);
+    write_varint(time_us - last_time_us);
+    write_varint(connection);
+
+    last_time_us = time_us;
+    pending      = true;
+}
+
+} //end of anonymous namespace
+
+bool start_capture(const std::string& path){
+    stop_capture();
+
+    capture_file = std::fopen(path.c_str(), "wb");
+
+    if(!capture_file){
+        return false;
+    }
+
+    std::setvbuf(capture_file, nullptr, _IOFBF, file_buffer_size);
+
+    auto epoch_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::fwrite(magic, 1, magic_size, capture_file);
+    for(std::size_t i = 0; i < 8; ++i){
+        std::fputc((std::uint64_t(epoch_us) >> (8 * i)) & 0xFF, capture_file);
+    }
+
+    start_time   = clock_type::now();
+    last_flush   = start_time;
+    last_time_us = 0;
+    pending      = true;
+
+    return true;
+}
+
+void stop_capture(){
+    if(capture_file){
+        std::fclose(capture_file);
+        capture_file = nullptr;
+    }
+
+    connection_ids.clear();
+}
+
+void flush_capture(){
+    if(!capture_file || !pending){
+        return;
+    }
+
+    auto now = clock_type::now();
+
+    if(now - last_flush >= flush_interval){
+        std::fflush(capture_file);
+        last_flush = now;
+        pending    = false;
+    }
+}
+
+bool capture_enabled(){
+    return capture_file != nullptr;
+}
+
+void capture_connect(int socket_fd){
+    if(!capture_file){
+        return;
+    }
+
+    auto id = next_connection++;
+    connection_ids[socket_fd] = id;
+
+    write_header(capture_kind::CONNECT, id);
+}
+
+void capture_message(int socket_fd, const char* data, std::size_t size, bool binary){
+    if(!capture_file){
+        return;
+    }
+
+    auto it = connection_ids.find(socket_fd);
+
+    // Connection accepted before the start of the capture
+    if(it == connection_ids.end()){
+        return;
+    }
+
+    write_header(binary ? capture_kind::BINARY : capture_kind::TEXT, it->second);
+    write_varint(size);
+    std::fwrite(data, 1, size, capture_file);
+}
+
+void capture_disconnect(int socket_fd){
+    if(!capture_file){
+        return;
+    }
+
+    auto it = connection_ids.find(socket_fd);
+
+    if(it != connection_ids.end()){
+        write_header(capture_kind::DISCONNECT, it->second);
+        connection_ids.erase(it);
+    }
+}
+
+capture_reader::capture_reader(const std::string& path){
+    file = std::fopen(path.c_str(), "rb");
+
+    if(!file){
+        return;
+    }
+
+    char header[magic_size + 8];
+
+    if(std::fread(header, 1, sizeof(header), file) != sizeof(header) || std::memcmp(header, magic, magic_size) != 0){
+        std::fclose(file);
+        file = nullptr;
+        return;
+    }
+
+    for(std::size_t i = 0; i < 8; ++i){
+        start_epoch |= std::uint64_t(static_cast<unsigned char>(header[magic_size + i])) << (8 * i);
+    }
+}
+
+capture_reader::~capture_reader(){
+    if(file){
+        std::fclose(file);
+    }
+}
+
+bool capture_reader::valid() const {
+    return file != nullptr;
+}
+
+bool capture_reader::next(capture_record& record){
+    if(!file){
+        return false;
+    }
+
+    auto kind = std::fgetc(file);
+
+    if(kind < static_cast<int>(capture_kind::CONNECT) || kind > static_cast<int>(capture_kind::DISCONNECT)){
+        return false;
+    }
+
+    std::uint64_t delta;
+    std::uint64_t connection;
+
+    if(!read_varint(file, delta) || !read_varint(file, connection)){
+        return false;
+    }
+
+    time_us += delta;
+
+    record.kind       = static_cast<capture_kind>(kind);
+    record.time_us    = time_us;
+    record.connection = connection;
+    record.data.clear();
+
+    if(record.kind == capture_kind::TEXT || record.kind == capture_kind::BINARY){
+        std::uint64_t size;
+
+        if(!read_varint(file, size)){
+            return false;
+        }
+
+        record.data.resize(size);
+
+        if(size && std::fread(&record.data[0], 1, size, file) != size){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::uint64_t capture_reader::start_epoch_us() const {
+    return start_epoch;
+}
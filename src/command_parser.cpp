@@ -0,0 +1,57 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cstdlib>
+#include <cctype>
+
+#include "command_parser.hpp"
+
+tokenizer::tokenizer(const char* message) : current(message) {}
+
+token tokenizer::next(){
+    while(*current && std::isspace(static_cast<unsigned char>(*current))){
+        ++current;
+    }
+
+    token result;
+    result.data = current;
+
+    while(*current && !std::isspace(static_cast<unsigned char>(*current))){
+        ++current;
+    }
+
+    result.size = current - result.data;
+
+    return result;
+}
+
+bool tokenizer::next_id(std::size_t& value){
+    auto text = next();
+
+    if(text.empty()){
+        return false;
+    }
+
+    // The message is null-terminated, the conversion stops at the end of the token
+    char* end;
+    value = std::strtoul(text.data, &end, 10);
+
+    return end == text.data + text.size;
+}
+
+bool tokenizer::next_double(double& value, token& text){
+    text = next();
+
+    if(text.empty()){
+        return false;
+    }
+
+    // Like atof, the non-numeric values are converted to 0 (the text is kept)
+    value = std::strtod(text.data, nullptr);
+
+    return true;
+}
@@ -5,15 +5,196 @@
 //  http://opensource.org/licenses/MIT)
 //=======================================================================
 
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "db.hpp"
+#include "device_stats.hpp"
+#include "migrations.hpp"
+#include "rollup.hpp"
+#include "scheduler.hpp"
+
+namespace {
 
 // Create the database object
 CppSQLite3DB db_impl;
 
+// The file of the database, set once connected
+std::string db_file;
+
+// Time (ms) a reader waits for a lock (only schema changes lock the readers)
+const int reader_busy_timeout = 5000;
+
+// Time (ms) a writer waits for the transaction of another writer connection
+const int writer_busy_timeout = 5000;
+
+// The read-only connections, one per thread
+std::mutex readers_lock;
+std::vector<std::unique_ptr<CppSQLite3DB>> readers;
+
+thread_local CppSQLite3DB* thread_reader = nullptr;
+
+std::atomic<std::size_t> reader_checkouts(0);
+std::atomic<std::size_t> reader_fallbacks(0);
+
+CppSQLite3DB* open_reader(){
+    if(db_file.empty()){
+        return nullptr;
+    }
+
+    std::unique_ptr<CppSQLite3DB> reader(new CppSQLite3DB);
+
+    try {
+        reader->open(db_file.c_str());
+        reader->setBusyTimeout(reader_busy_timeout);
+        reader->execDML("pragma query_only = 1;");
+    } catch (CppSQLite3Exception& e) {
+        ASGARD_ERROR << "asgard: db: Unable to open a reader: " << e.errorCode() << ":" << e.errorMessage();
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> l(readers_lock);
+
+    readers.push_back(std::move(reader));
+
+    return readers.back().get();
+}
+
+// Maximum number of statements cached by one thread for one database
+const std::size_t max_cached_statements = 128;
+
+std::atomic<std::size_t> statement_hits(0);
+std::atomic<std::size_t> statement_misses(0);
+
+struct cached_statement {
+    CppSQLite3Statement statement;
+    std::size_t last_use; ///< Number of the last preparation, for the eviction
+};
+
+using statement_cache = std::unordered_map<std::string, cached_statement>;
+
+thread_local std::unordered_map<const CppSQLite3DB*, statement_cache> statement_caches;
+thread_local std::size_t statement_uses = 0;
+
+// Only the least recently used statement is finalized, the statements of the
+// queries still being iterated by the caller have been used much more recently
+void evict_statement(statement_cache& cache){
+    auto oldest = cache.begin();
+
+    for(auto it = cache.begin(); it != cache.end(); ++it){
+        if(it->second.last_use < oldest->second.last_use){
+            oldest = it;
+        }
+    }
+
+    cache.erase(oldest);
+}
+
+// Convert the printf-like placeholders into SQL parameters
+std::string to_sql_parameters(const std::string& query){
+    std::string sql;
+    sql.reserve(query.size());
+
+    bool literal = false;
+
+    for(std::size_t i = 0; i < query.size(); ++i){
+        if(query[i] == '\''){
+            // Placeholders are not replaced inside string literals (e.g. strftime('%s'))
+            literal = !literal;
+            sql += query[i];
+        } else if(literal){
+            sql += query[i];
+        } else if(query.compare(i, 4, "\"%s\"") == 0){
+            sql += '?';
+            i += 3;
+        } else if(query.compare(i, 2, "%d") == 0 || query.compare(i, 2, "%s") == 0 || query.compare(i, 2, "%f") == 0){
+            sql += '?';
+            i += 1;
+        } else {
+            sql += query[i];
+        }
+    }
+
+    return sql;
+}
+
+} //end of anonymous namespace
+
 CppSQLite3DB& get_db(){
     return db_impl;
 }
 
+db_reader::db_reader(){
+    ++reader_checkouts;
+
+    if(!thread_reader){
+        thread_reader = open_reader();
+    }
+
+    if(thread_reader){
+        connection = thread_reader;
+    } else {
+        // Before the connection or if the reader could not be opened
+        ++reader_fallbacks;
+        connection = &db_impl;
+    }
+}
+
+db_reader_stats get_db_reader_stats(){
+    std::size_t connections;
+
+    {
+        std::lock_guard<std::mutex> l(readers_lock);
+        connections = readers.size();
+    }
+
+    return {connections, reader_checkouts.load(), reader_fallbacks.load()};
+}
+
+CppSQLite3Statement& db_prepare(CppSQLite3DB& db, const std::string& query){
+    auto& cache = statement_caches[&db];
+
+    auto it = cache.find(query);
+
+    if(it != cache.end()){
+        ++statement_hits;
+
+        it->second.last_use = ++statement_uses;
+
+        try {
+            it->second.statement.reset();
+        } catch (CppSQLite3Exception& e) {
+            // The error belongs to the previous execution of the statement
+        }
+
+        return it->second.statement;
+    }
+
+    ++statement_misses;
+
+    // Compile first so that a failed compilation does not leave an empty entry
+    auto statement = db.compileStatement(to_sql_parameters(query).c_str());
+
+    if(cache.size() >= max_cached_statements){
+        evict_statement(cache);
+    }
+
+    return cache.emplace(query, cached_statement{statement, ++statement_uses}).first->second.statement;
+}
+
+db_statement_stats get_db_statement_stats(){
+    std::size_t compiled = 0;
+
+    for(auto& cache : statement_caches){
+        compiled += cache.second.size();
+    }
+
+    return {statement_hits.load(), statement_misses.load(), compiled};
+}
+
 query_iterator::query_iterator(CppSQLite3Query& query, bool end) : query(query), end(end) {
     if(!end && query.eof()){
         this->end = true;
@@ -83,16 +264,57 @@ void create_tables(CppSQLite3DB& db) {
 bool db_connect(CppSQLite3DB& db) {
     try {
         db.open("asgard.db");
+        db.setBusyTimeout(writer_busy_timeout);
+
+        // The readers of the web interface do not wait behind the writer
+        CppSQLite3Query journal = db.execQuery("pragma journal_mode = wal;");
+
+        if (journal.eof() || std::string(journal.getStringField(0)) != "wal") {
+            ASGARD_WARNING << "asgard: db: Unable to enable WAL mode, the readers will wait for the writer";
+        }
+
+        journal.finalize();
+
+        // WAL is durable at checkpoints, a power loss can only lose the last transactions
+        db.execDML("pragma synchronous = normal;");
 
         // Create tables
         create_tables(db);
+        create_rollup_tables(db);
+        create_device_stats_tables(db);
+        create_scheduler_tables(db);
+
+        // Upgrade the existing installations
+        if (!run_migrations(db)) {
+            return false;
+        }
 
         // Perform pi insertion
         db.execDML("insert into pi(name) select 'tyr' where not exists(select 1 from pi where name='tyr');");
 
+        // The readers are only opened once the schema is up to date
+        db_file = "asgard.db";
+
+        return true;
+    } catch (CppSQLite3Exception& e) {
+        ASGARD_ERROR << "asgard: db: Unable to open the database: " << e.errorCode() << ":" << e.errorMessage();
+    }
+
+    return false;
+}
+
+bool db_open_writer(CppSQLite3DB& db){
+    if(db_file.empty()){
+        return false;
+    }
+
+    try {
+        db.open(db_file.c_str());
+        db.setBusyTimeout(writer_busy_timeout);
+        db.execDML("pragma synchronous = normal;");
         return true;
     } catch (CppSQLite3Exception& e) {
-        std::cerr << e.errorCode() << ":" << e.errorMessage() << std::endl;
+        ASGARD_ERROR << "asgard: db: Unable to open a writer: " << e.errorCode() << ":" << e.errorMessage();
     }
 
     return false;
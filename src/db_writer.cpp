@@ -0,0 +1,259 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+
+#include <ctime>
+#include <cstdint>
+#include <cstring>
+
+#include "db.hpp"
+#include "db_writer.hpp"
+#include "device_stats.hpp"
+#include "migrations.hpp"
+#include "retention.hpp"
+#include "rollup.hpp"
+
+namespace {
+
+struct sample {
+    bool sensor;
+    std::size_t fk;
+    std::int64_t epoch_ms;
+    double value; ///< Parsed value of the sensors
+    char data[max_sample_size + 1];
+};
+
+// Number of legacy sensor values converted between two batches
+const std::size_t migration_batch_size = 2000;
+
+std::size_t batch_size;
+std::chrono::milliseconds batch_time;
+std::size_t max_queue;
+
+std::mutex queue_lock;
+std::condition_variable queue_ready;
+std::vector<sample> queue;
+bool stopping = false;
+
+// The legacy sensor history is converted by the writer, before any pruning
+bool migrating = true;
+
+// The times are the keys of sensor_value, they must be unique for a sensor
+std::unordered_map<std::size_t, std::int64_t> last_sensor_time;
+
+std::thread writer_thread;
+
+// The batches have their own connection, the other writes never join their transaction
+CppSQLite3DB writer_db;
+
+db_writer_stats stats{};
+
+// Same format as SQLite current_timestamp (UTC)
+std::string format_time(std::time_t now){
+    std::tm tm;
+    gmtime_r(&now, &tm);
+
+    char buffer[32];
+    auto n = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+
+    return {buffer, n};
+}
+
+bool push(bool sensor, std::size_t fk, double value, const char* data, std::size_t size){
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    {
+        std::lock_guard<std::mutex> l(queue_lock);
+
+        if(queue.size() >= max_queue){
+            ++stats.dropped;
+            return false;
+        }
+
+        // The capacity of the queue is kept between the batches
+        queue.emplace_back();
+
+        auto& s  = queue.back();
+        s.sensor   = sensor;
+        s.fk       = fk;
+        s.epoch_ms = now;
+        s.value    = value;
+
+        size = std::min(size, max_sample_size);
+        std::memcpy(s.data, data, size);
+        s.data[size] = '\0';
+
+        stats.queue_depth = queue.size();
+    }
+
+    queue_ready.notify_one();
+
+    return true;
+}
+
+// Roll back the batch after a failure, there is no transaction if begin failed
+void rollback(CppSQLite3DB& db){
+    try {
+        db.execDML("rollback transaction;");
+    } catch (CppSQLite3Exception& e) {
+        // No transaction is open
+    }
+}
+
+void write_batch(std::vector<sample>& batch){
+    auto start = std::chrono::steady_clock::now();
+
+    auto& db = writer_db;
+
+    // The lock is taken at the start, a busy database fails here and not in the middle of the batch
+    try {
+        db.execDML("begin immediate transaction;");
+    } catch (CppSQLite3Exception& e) {
+        ASGARD_ERROR << "asgard: db: Unable to start a batch: " << e.errorCode() << ":" << e.errorMessage();
+
+        std::lock_guard<std::mutex> l(queue_lock);
+        stats.failed += batch.size();
+        return;
+    }
+
+    for(auto& s : batch){
+        auto epoch = std::time_t(s.epoch_ms / 1000);
+        auto time  = format_time(epoch);
+
+        if(s.sensor){
+            auto value = s.value;
+
+            auto& last = last_sensor_time[s.fk];
+            auto time_ms = std::max(s.epoch_ms, last + 1);
+            last = time_ms;
+
+            db_exec_dml(db, "insert or ignore into sensor_value(fk_sensor, time, value) values (%d, %d, %f);", s.fk, time_ms, value);
+            update_rollups(db, s.fk, epoch, value);
+            update_device_stats(db, device_kind::SENSOR, s.fk, s.data, time);
+        } else {
+            db_exec_dml(db, "insert into actuator_data (data, time, fk_actuator) values (\"%s\", \"%s\", %d);", s.data, time.c_str(), int(s.fk));
+            update_device_stats(db, device_kind::ACTUATOR, s.fk, s.data, time);
+        }
+    }
+
+    try {
+        db.execDML("commit transaction;");
+    } catch (CppSQLite3Exception& e) {
+        ASGARD_ERROR << "asgard: db: Unable to commit a batch: " << e.errorCode() << ":" << e.errorMessage();
+
+        rollback(db);
+
+        std::lock_guard<std::mutex> l(queue_lock);
+        stats.failed += batch.size();
+        return;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    auto us  = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    std::lock_guard<std::mutex> l(queue_lock);
+
+    stats.written += batch.size();
+    ++stats.batches;
+    stats.last_commit_us = us;
+    stats.max_commit_us  = std::max<std::size_t>(stats.max_commit_us, us);
+}
+
+void writer_loop(){
+    std::vector<sample> batch;
+
+    while(true){
+        {
+            std::unique_lock<std::mutex> l(queue_lock);
+
+            // Wake up regularly even without samples, for the maintenance
+            queue_ready.wait_for(l, batch_time, []{ return stopping || !queue.empty(); });
+
+            if(queue.empty() && stopping){
+                return;
+            }
+
+            if(!queue.empty()){
+                // Group commit: wait for a full batch or for the time limit
+                queue_ready.wait_for(l, batch_time, []{ return stopping || queue.size() >= batch_size; });
+
+                batch.swap(queue);
+                stats.queue_depth = 0;
+            }
+        }
+
+        if(!batch.empty()){
+            write_batch(batch);
+            batch.clear();
+        }
+
+        // The maintenance runs between the batches, the ingest is only
+        // delayed by one small step at a time
+        if(migrating){
+            if(!migrate_sensor_data_batch(writer_db, migration_batch_size)){
+                ASGARD_INFO << "asgard: db: The conversion of the sensor history is finished";
+                migrating = false;
+            }
+        } else {
+            prune_step(writer_db);
+        }
+    }
+}
+
+} //end of anonymous namespace
+
+bool start_db_writer(std::size_t size, std::size_t ms, std::size_t max){
+    if(!db_open_writer(writer_db)){
+        return false;
+    }
+
+    batch_size = size;
+    batch_time = std::chrono::milliseconds(ms);
+    max_queue  = max;
+
+    queue.reserve(std::min(batch_size, max_queue));
+
+    writer_thread = std::thread(writer_loop);
+
+    return true;
+}
+
+void stop_db_writer(){
+    if(!writer_thread.joinable()){
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(queue_lock);
+        stopping = true;
+    }
+
+    queue_ready.notify_one();
+
+    // The remaining samples are flushed before the thread exits
+    writer_thread.join();
+}
+
+bool push_sensor_data(std::size_t fk_sensor, double value, const char* data, std::size_t size){
+    return push(true, fk_sensor, value, data, size);
+}
+
+bool push_actuator_data(std::size_t fk_actuator, const char* data, std::size_t size){
+    return push(false, fk_actuator, 0.0, data, size);
+}
+
+db_writer_stats get_db_writer_stats(){
+    std::lock_guard<std::mutex> l(queue_lock);
+    return stats;
+}
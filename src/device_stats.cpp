@@ -0,0 +1,64 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cstdlib>
+
+#include "device_stats.hpp"
+
+void create_device_stats_tables(CppSQLite3DB& db){
+    bool exists = db.tableExists("device_stats");
+
+    db.execDML(
+        "create table if not exists device_stats(kind integer, fk_device integer, last_value char(20), last_time datetime,"
+        "count integer, min real, max real, sum real, primary key(kind, fk_device));");
+
+    if(!exists){
+        // Summarize the existing history
+
+        ASGARD_INFO << "asgard: db: Build the device statistics from the history";
+
+        db.execDML(
+            "insert into device_stats(kind, fk_device, last_value, last_time, count, min, max, sum) "
+            "select 0, fk_sensor, (select data from sensor_data last where last.fk_sensor = sensor_data.fk_sensor order by time desc limit 1), "
+            "max(time), count(data), min(cast(data as real)), max(cast(data as real)), sum(cast(data as real)) "
+            "from sensor_data group by fk_sensor;");
+
+        db.execDML(
+            "insert into device_stats(kind, fk_device, last_value, last_time, count, min, max, sum) "
+            "select 1, fk_actuator, (select data from actuator_data last where last.fk_actuator = actuator_data.fk_actuator order by time desc limit 1), "
+            "max(time), count(data), min(cast(data as real)), max(cast(data as real)), sum(cast(data as real)) "
+            "from actuator_data group by fk_actuator;");
+    }
+}
+
+void update_device_stats(CppSQLite3DB& db, device_kind kind, std::size_t fk_device, const char* value, const std::string& time){
+    auto number = std::atof(value);
+
+    db_exec_dml(db, "insert or ignore into device_stats(kind, fk_device, count, min, max, sum) values (%d, %d, 0, %f, %f, 0);",
+                int(kind), fk_device, number, number);
+    db_exec_dml(db, "update device_stats set last_value = \"%s\", last_time = \"%s\", count = count + 1, "
+                    "min = min(min, %f), max = max(max, %f), sum = sum + %f where kind = %d and fk_device = %d;",
+                value, time.c_str(), number, number, number, int(kind), fk_device);
+}
+
+bool get_device_stats(CppSQLite3DB& db, device_kind kind, std::size_t fk_device, device_stats& stats){
+    CppSQLite3Query query = db_exec_query(db,
+        "select last_value, last_time, count, min, max, sum from device_stats where kind = %d and fk_device = %d;", int(kind), fk_device);
+
+    if(query.eof()){
+        return false;
+    }
+
+    stats.last_value = query.fieldValue(0);
+    stats.last_time  = query.fieldValue(1);
+    stats.count      = query.getInt64Field(2);
+    stats.min        = query.getFloatField(3);
+    stats.max        = query.getFloatField(4);
+    stats.sum        = query.getFloatField(5);
+
+    return true;
+}
@@ -6,14 +6,46 @@
 //=======================================================================
 
 #include<algorithm>
-#include<chrono>
+#include<ctime>
+#include<cstdio>
+#include<cstdlib>
 
 #include "display_controller.hpp"
 #include "db.hpp"
+#include "db_writer.hpp"
+#include "device_stats.hpp"
+#include "display_tables.hpp"
+#include "event_stream.hpp"
+#include "executor.hpp"
+#include "fragment_cache.hpp"
 #include "led.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "rules.hpp"
+#include "scheduler.hpp"
+#include "retention.hpp"
+#include "rollup.hpp"
+#include "sample_buffer.hpp"
 #include "server.hpp"
 
-const std::vector<size_t> interval{1, 24, 48};
+struct chart_interval {
+    std::size_t hours;
+    const char* label;
+};
+
+const std::vector<chart_interval> interval{{1, "1h"}, {24, "24h"}, {48, "48h"}, {168, "1w"}, {720, "1m"}, {8760, "1y"}};
+
+// Number of points needed to fill a chart
+const std::size_t chart_points = 300;
+
+// Maximum number of points of one page of the history API
+const std::size_t max_history_points = 5000;
+
+// Maximum number of events of one response of the live updates
+const std::size_t max_stream_events = 256;
+
+// Time the browser waits before asking for the next live updates
+const std::size_t stream_retry_ms = 1000;
 
 std::string header = R"=====(
 <!DOCTYPE html>
@@ -66,30 +98,204 @@ function load_menu(name) {
 <body>
 )=====";
 
+// The devices are only refreshed once they received a value. Without
+// EventSource, or until the first answer, they are refreshed periodically.
+std::string live_updates = R"=====(
+<script>
+var asgard_dirty = {};
+var asgard_live = false;
+if (window.EventSource) {
+    var asgard_events = new EventSource("/events");
+    asgard_events.addEventListener("sensor", function(e) { asgard_dirty["s" + JSON.parse(e.data).pk] = true; });
+    asgard_events.addEventListener("actuator", function(e) { asgard_dirty["a" + JSON.parse(e.data).pk] = true; });
+    asgard_events.addEventListener("reset", function() { location.reload(); });
+    asgard_events.onopen = function() { asgard_live = true; };
+    asgard_events.onerror = function() { asgard_live = asgard_events.readyState != EventSource.CLOSED; };
+}
+function asgard_changed(key) {
+    var changed = !asgard_live || asgard_dirty[key];
+    delete asgard_dirty[key];
+    return changed;
+}
+</script>
+)=====";
+
 namespace {
 
-struct request_timer {
-    std::string name;
-    std::chrono::steady_clock::time_point start_time;
+metric_histogram& route_latency(const char* route){
+    return get_histogram("asgard_http_request_duration_seconds", "Time to render a page or an API response", std::string("route=\"") + route + "\"");
+}
 
-    request_timer(const std::string& name) : name(name) {
-        start_time = std::chrono::steady_clock::now();
+bool last_sensor_value(int sensor_pk, std::string& value){
+    // Served from memory for the sensors registered since startup
+    auto history = sensor_history(sensor_pk);
+    if (history && history->latest(value)) {
+        return true;
+    }
 
-        std::cout << "DEBUG: asgard: Start rendering " << name << std::endl;
+    db_reader reader;
+
+    device_stats stats;
+    if (!get_device_stats(reader.db(), device_kind::SENSOR, sensor_pk, stats)) {
+        return false;
     }
 
-    ~request_timer(){
-        auto end_time = std::chrono::steady_clock::now();
-        auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    value = stats.last_value;
+    return true;
+}
 
-        std::cout << "DEBUG: asgard: Finished rendering " << name << " in" << time_ms << "ms" << std::endl;
+bool last_actuator_value(int actuator_pk, std::string& value){
+    // Served from memory for the actuators registered since startup
+    auto history = actuator_history(actuator_pk);
+    if (history && history->latest(value)) {
+        return true;
     }
+
+    db_reader reader;
+
+    device_stats stats;
+    if (!get_device_stats(reader.db(), device_kind::ACTUATOR, actuator_pk, stats)) {
+        return false;
+    }
+
+    value = stats.last_value;
+    return true;
+}
+
+// Same format as the times stored in the database
+std::string format_time(std::time_t time){
+    std::tm tm;
+    gmtime_r(&time, &tm);
+
+    char buffer[32];
+    auto n = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+
+    return {buffer, n};
+}
+
+// Parse a comma-separated list of pks, as given in the filter of the live updates
+std::vector<std::size_t> parse_pk_list(const std::string& value){
+    std::vector<std::size_t> pks;
+
+    const char* it = value.c_str();
+    while(*it){
+        char* end;
+        auto pk = std::strtoul(it, &end, 10);
+
+        if(end != it){
+            pks.push_back(pk);
+        }
+
+        it = *end ? end + 1 : end;
+    }
+
+    return pks;
+}
+
+// Write a string as a JSON string
+void write_json_string(std::ostream& out, const char* value){
+    out << '"';
+
+    for(; *value; ++value){
+        auto c = *value;
+
+        if(c == '"' || c == '\\'){
+            out << '\\' << c;
+        } else if(static_cast<unsigned char>(c) < 0x20){
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+
+    out << '"';
+}
+
+struct history_range {
+    std::time_t from;
+    std::time_t to;
+    std::size_t step;
+    std::size_t limit;
 };
 
+// Read from, to, step and limit from the query string, the default is the last 24 hours
+history_range parse_history_range(Mongoose::Request& request){
+    history_range range;
+
+    auto now = std::time(nullptr);
+
+    auto to   = request.get("to", "");
+    auto from = request.get("from", "");
+
+    range.to    = to.empty() ? now + 1 : std::atol(to.c_str());
+    range.from  = from.empty() ? range.to - 24 * 3600 : std::atol(from.c_str());
+    range.step  = std::atol(request.get("step", "0").c_str());
+    range.limit = std::atol(request.get("limit", "0").c_str());
+
+    if(!range.limit || range.limit > max_history_points){
+        range.limit = max_history_points;
+    }
+
+    return range;
+}
+
+/*!
+ * \brief Write the rows of (epoch, value) as JSON points, directly from the cursor.
+ *
+ * At most limit points are written, without splitting the points of the same
+ * second. The time of the first point not written is returned as "next", to
+ * be given as "from" for the next page.
+ */
+void write_history(std::ostream& response, CppSQLite3Query& query, std::size_t limit, bool numeric){
+    response << "\"points\":[";
+
+    std::size_t count = 0;
+    long long last = 0;
+    long long next = 0;
+
+    for(; !query.eof(); query.nextRow()){
+        auto time = query.getInt64Field(0);
+
+        if(count >= limit && time != last){
+            next = time;
+            break;
+        }
+
+        if(count){
+            response << ',';
+        }
+
+        response << '[' << time << ',';
+
+        if(numeric){
+            response << query.getFloatField(1);
+        } else {
+            write_json_string(response, query.fieldValue(1));
+        }
+
+        response << ']';
+
+        last = time;
+        ++count;
+    }
+
+    response << "],\"count\":" << count << ",\"next\":";
+
+    if(next){
+        response << next;
+    } else {
+        response << "null";
+    }
+}
+
 } // end of anoymous namespace
 
-void display_controller::display_controller::display_menu(Mongoose::StreamResponse& response) {
-    std::cout << "DEBUG: asgard: Begin rendering menu" << std::endl;
+void display_controller::display_controller::display_menu(std::ostream& response) {
+    db_reader reader;
+
+    ASGARD_DEBUG << "asgard: Begin rendering menu";
 
     response << "<ul class=\"menu\"><li onclick=\"location.href='/actions'\">Actions Page</li>" << std::endl
              << "<li onclick=\"location.href='/rules'\">Rules Page</li>" << std::endl
@@ -97,7 +303,7 @@ void display_controller::display_controller::display_menu(Mongoose::StreamRespon
              << "<p>Drivers registered :</p>" << std::endl
              << "<ul class=\"menu\">" << std::endl;
 
-    CppSQLite3Query source_query = get_db().execQuery("select name, pk_source from source order by name;");
+    CppSQLite3Query source_query = reader.db().execQuery("select name, pk_source from source order by name;");
 
     while (!source_query.eof()) {
         std::string source_name = source_query.fieldValue(0);
@@ -110,7 +316,7 @@ void display_controller::display_controller::display_menu(Mongoose::StreamRespon
              << "<p>Sensors active :</p>" << std::endl
              << "<ul class=\"menu\">" << std::endl;
 
-    CppSQLite3Query sensor_query = get_db().execQuery("select distinct name from sensor order by name;");
+    CppSQLite3Query sensor_query = reader.db().execQuery("select distinct name from sensor order by name;");
 
     while (!sensor_query.eof()) {
         std::string sensor_name = sensor_query.fieldValue(0);
@@ -122,7 +328,7 @@ void display_controller::display_controller::display_menu(Mongoose::StreamRespon
              << "<p>Actuators active :</p>" << std::endl
              << "<ul class=\"menu\">" << std::endl;
 
-    CppSQLite3Query actuator_query = get_db().execQuery("select name from actuator order by name;");
+    CppSQLite3Query actuator_query = reader.db().execQuery("select name from actuator order by name;");
 
     while (!actuator_query.eof()) {
         std::string actuator_name = actuator_query.fieldValue(0);
@@ -137,20 +343,22 @@ void display_controller::display_controller::display_menu(Mongoose::StreamRespon
              << "</div></div>" << std::endl
              << "<div id=\"main\">" << std::endl;
 
-    std::cout << "DEBUG: asgard: End rendering menu" << std::endl;
+    ASGARD_DEBUG << "asgard: End rendering menu";
 }
 
-void display_controller::display_controller::display_sensors(Mongoose::StreamResponse& response) {
-    std::cout << "DEBUG: asgard: Begin rendering sensors" << std::endl;
+void display_controller::display_controller::display_sensors(std::ostream& response) {
+    db_reader reader;
 
-    for (auto& data : get_db().execQuery("select name, type, pk_sensor from sensor order by name;")) {
+    ASGARD_DEBUG << "asgard: Begin rendering sensors";
+
+    for (auto& data : reader.db().execQuery("select name, type, pk_sensor from sensor order by name;")) {
         std::string sensor_name = data.fieldValue(0);
         std::string sensor_type = data.fieldValue(1);
         int sensor_pk = data.getIntField(2);
 
-        CppSQLite3Query sensor_data = db_exec_query(get_db(), "select data from sensor_data where fk_sensor=%d order by time desc limit 1;", sensor_pk);
+        std::string sensor_data;
 
-        if (!sensor_data.eof()) {
+        if (last_sensor_value(sensor_pk, sensor_data)) {
             std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
 
             std::string url_data   = sensor_name + "/" + sensor_type + "/data";
@@ -166,7 +374,7 @@ void display_controller::display_controller::display_sensors(Mongoose::StreamRes
 
                      << "setInterval(function() {" << std::endl
 
-                     << "if ($(\"#" << sensor_name << "_" << sensor_type << "\").is(\":visible\")) {" << std::endl
+                     << "if ($(\"#" << sensor_name << "_" << sensor_type << "\").is(\":visible\") && asgard_changed(\"s" << sensor_pk << "\")) {" << std::endl
 
                      << "$(\"#" << sensor_name << "_" << sensor_type << "\").load(\"/" << url_data << "\", function() {" << std::endl
                      << "$.ajaxSetup({ cache: false });" << std::endl
@@ -179,19 +387,21 @@ void display_controller::display_controller::display_sensors(Mongoose::StreamRes
         }
     }
 
-    std::cout << "DEBUG: asgard: End rendering sensors" << std::endl;
+    ASGARD_DEBUG << "asgard: End rendering sensors";
 }
 
-void display_controller::display_controller::display_actuators(Mongoose::StreamResponse& response) {
-    std::cout << "DEBUG: asgard: Begin rendering actuators" << std::endl;
+void display_controller::display_controller::display_actuators(std::ostream& response) {
+    db_reader reader;
+
+    ASGARD_DEBUG << "asgard: Begin rendering actuators";
 
-    for (auto& data : get_db().execQuery("select name, pk_actuator from actuator order by name;")) {
+    for (auto& data : reader.db().execQuery("select name, pk_actuator from actuator order by name;")) {
         std::string actuator_name = data.fieldValue(0);
         int actuator_pk = data.getIntField(1);
 
-        CppSQLite3Query actuator_data = db_exec_query(get_db(), "select data from actuator_data where fk_actuator=%d order by time desc limit 1;", actuator_pk);
+        std::string actuator_data;
 
-        if (!actuator_data.eof()) {
+        if (last_actuator_value(actuator_pk, actuator_data)) {
             std::string url_data   = actuator_name + "/data";
             std::string url_script = actuator_name + "/script";
 
@@ -205,7 +415,7 @@ void display_controller::display_controller::display_actuators(Mongoose::StreamR
 
                      << "setInterval(function() {" << std::endl
 
-                     << "if ($(\"#" << actuator_name << "_script\").is(\":visible\")) {" << std::endl
+                     << "if ($(\"#" << actuator_name << "_script\").is(\":visible\") && asgard_changed(\"a" << actuator_pk << "\")) {" << std::endl
 
                      << "$(\"#" << actuator_name << "_script\").load(\"/" << url_data << "\", function() {" << std::endl
                      << "$.ajaxSetup({ cache: false });" << std::endl
@@ -218,41 +428,58 @@ void display_controller::display_controller::display_actuators(Mongoose::StreamR
         }
     }
 
-    std::cout << "DEBUG: asgard: End rendering actuators" << std::endl;
+    ASGARD_DEBUG << "asgard: End rendering actuators";
 }
 
-void display_controller::display_controller::display(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response){
-    request_timer timer("home");
+void display_controller::display_controller::display_load_source(std::ostream& response){
+    db_reader reader;
 
-    response << header << std::endl
-             << "<div id=\"header\"><center><h2>Asgard - Home Automation System</h2></center></div>" << std::endl
-             << "<div id=\"container\"><div id=\"sidebar\"><div class=\"tabs\" style=\"width: 240px;\">" << std::endl
-             << "<ul><li class=\"title\">Current information</li></ul>" << std::endl;
+    response << "<script>function load_source(pk) {" << std::endl;
+    response << "$('.hideable').hide();" << std::endl;
 
-    try {
-        response << "<script>function load_source(pk) {" << std::endl;
-        response << "$('.hideable').hide();" << std::endl;
+    for (auto& data : reader.db().execQuery("select distinct name, fk_source from sensor order by name;")) {
+        std::string sensor_name = data.fieldValue(0);
+        int sensor_fk = data.getIntField(1);
+        response << "if (pk == " << sensor_fk << ") { $('." << sensor_name << "').show(); }" << std::endl;
+    }
 
-        for (auto& data : get_db().execQuery("select distinct name, fk_source from sensor order by name;")) {
-            std::string sensor_name = data.fieldValue(0);
-            int sensor_fk = data.getIntField(1);
-            response << "if (pk == " << sensor_fk << ") { $('." << sensor_name << "').show(); }" << std::endl;
-        }
+    for (auto& data : reader.db().execQuery("select distinct name, fk_source from actuator order by name;")) {
+        std::string actuator_name = data.fieldValue(0);
+        int actuator_fk = data.getIntField(1);
+        response << "if (pk == " << actuator_fk << ") { $('." << actuator_name << "').show(); }" << std::endl;
+    }
 
-        for (auto& data : get_db().execQuery("select distinct name, fk_source from actuator order by name;")) {
-            std::string actuator_name = data.fieldValue(0);
-            int actuator_fk = data.getIntField(1);
-            response << "if (pk == " << actuator_fk << ") { $('." << actuator_name << "').show(); }" << std::endl;
-        }
+    response << "}" << "</script>" << std::endl;
+}
 
-        response << "}" << "</script>" << std::endl;
+void display_controller::display_controller::display(Mongoose::Request& request, Mongoose::StreamResponse& response){
+    static auto& latency = route_latency("home");
+    latency_timer timer(latency);
 
-        display_menu(response);
-        display_sensors(response);
-        display_actuators(response);
+    // The page only changes with the devices, let the browser revalidate it
+    auto etag = fragments_etag();
+
+    response.setHeader("ETag", etag);
+    response.setHeader("Cache-Control", "no-cache");
+
+    if (request.getHeaderKeyValue("If-None-Match") == etag) {
+        response.setCode(304);
+        return;
+    }
 
+    response << header << std::endl
+             << live_updates << std::endl
+             << "<div id=\"header\"><center><h2>Asgard - Home Automation System</h2></center></div>" << std::endl
+             << "<div id=\"container\"><div id=\"sidebar\"><div class=\"tabs\" style=\"width: 240px;\">" << std::endl
+             << "<ul><li class=\"title\">Current information</li></ul>" << std::endl;
+
+    try {
+        response << *cached_fragment("load_source", [this](std::ostream& out){ display_load_source(out); })
+                 << *cached_fragment("menu", [this](std::ostream& out){ display_menu(out); })
+                 << *cached_fragment("sensors", [this](std::ostream& out){ display_sensors(out); })
+                 << *cached_fragment("actuators", [this](std::ostream& out){ display_actuators(out); });
     } catch (CppSQLite3Exception& e) {
-        std::cerr << e.errorCode() << ":" << e.errorMessage() << std::endl;
+        ASGARD_ERROR << e.errorCode() << ":" << e.errorMessage();
     }
 
     response << "</div></div>" << std::endl
@@ -270,7 +497,10 @@ void display_controller::led_off(Mongoose::Request& request, Mongoose::StreamRes
 }
 
 void display_controller::sensor_data(Mongoose::Request& request, Mongoose::StreamResponse& response) {
-    request_timer timer("sensor_data");
+    static auto& latency = route_latency("sensor_data");
+    latency_timer timer(latency);
+
+    db_reader reader;
 
     std::string url = request.getUrl();
 
@@ -285,16 +515,15 @@ void display_controller::sensor_data(Mongoose::Request& request, Mongoose::Strea
 
     std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::toupper);
 
-    int sensor_pk = db_exec_scalar(get_db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor_name.c_str(), sensor_type.c_str());
+    int sensor_pk = db_exec_scalar(reader.db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor_name.c_str(), sensor_type.c_str());
 
     std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
 
     sensor_type[0] = toupper(sensor_type[0]);
-    CppSQLite3Query sensor_query = db_exec_query(get_db(), "select data from sensor_data where fk_sensor=%d order by time desc limit 1;", sensor_pk);
 
-    if (!sensor_query.eof()) {
-        std::string sensor_data = sensor_query.fieldValue(0);
+    std::string sensor_data;
 
+    if (last_sensor_value(sensor_pk, sensor_data)) {
         auto div_id = sensor_name + sensor_type;
 
         if (sensor_type == "Temperature" || sensor_type == "Humidity") {
@@ -303,7 +532,7 @@ void display_controller::sensor_data(Mongoose::Request& request, Mongoose::Strea
 
             for (size_t i = 0; i < interval.size(); ++i) {
                 response << "<li class=\"myTabs\"><a href=\"#" << sensor_name << sensor_type << i
-                         << "\" data-toggle=\"tab\">" << interval[i] << "h </a></li>" << std::endl;
+                         << "\" data-toggle=\"tab\">" << interval[i].label << " </a></li>" << std::endl;
             }
 
             response << "</ul>" << std::endl;
@@ -322,15 +551,19 @@ void display_controller::sensor_data(Mongoose::Request& request, Mongoose::Strea
                      << sensor_name << " (" << sensor_type << ")</li></ul>"
                      << "<ul><li>Last Value : " << sensor_data << "</li>" << std::endl;
 
-            int nbValue = db_exec_scalar(get_db(), "select count(data) from sensor_data where fk_sensor=%d;", sensor_pk);
-            response << "<li>Number of Values : " << nbValue << "</li></ul>" << std::endl;
+            device_stats stats{};
+            get_device_stats(reader.db(), device_kind::SENSOR, sensor_pk, stats);
+            response << "<li>Number of Values : " << stats.count << "</li></ul>" << std::endl;
         }
         response << "</div>" << std::endl;
     }
 }
 
 void display_controller::sensor_script(Mongoose::Request& request, Mongoose::StreamResponse& response) {
-    request_timer timer("sensor_script");
+    static auto& latency = route_latency("sensor_script");
+    latency_timer timer(latency);
+
+    db_reader reader;
 
     std::string url = request.getUrl();
 
@@ -345,14 +578,20 @@ void display_controller::sensor_script(Mongoose::Request& request, Mongoose::Str
 
     std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::toupper);
 
-    int sensor_pk = db_exec_scalar(get_db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor_name.c_str(), sensor_type.c_str());
+    int sensor_pk = db_exec_scalar(reader.db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor_name.c_str(), sensor_type.c_str());
 
     std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
 
     sensor_type[0] = toupper(sensor_type[0]);
-    CppSQLite3Query sensor_query = db_exec_query(get_db(), "select data from sensor_data where fk_sensor=%d limit 1;", sensor_pk);
 
-    if (!sensor_query.eof()) {
+    std::string last_data;
+
+    if (last_sensor_value(sensor_pk, last_data)) {
+        auto history = sensor_history(sensor_pk);
+
+        std::vector<std::time_t> recent_times;
+        std::vector<double> recent_values;
+
         auto div_id = sensor_name + sensor_type;
 
         if (sensor_type == "Temperature" || sensor_type == "Humidity") {
@@ -362,23 +601,47 @@ void display_controller::sensor_script(Mongoose::Request& request, Mongoose::Str
                 response << "$('#" << div_id << i
                          << "').highcharts({chart: {marginBottom: 60}, title: {text: ''}, xAxis: {categories: [";
 
-                CppSQLite3Query sensor_interval = db_exec_query(
-                    get_db(), "select time, data from sensor_data where time > datetime('now', '-%d hours') and fk_sensor=%d order by time;", interval[i], sensor_pk);
+                auto seconds    = interval[i].hours * 3600;
+                auto resolution = select_rollup_resolution(seconds, chart_points);
+                auto from       = std::time(nullptr) - seconds;
 
                 std::string sensor_time;
                 std::string sensor_data_line;
 
-                while (!sensor_interval.eof()) {
-                    sensor_time = sensor_interval.fieldValue(0);
-                    response << "\"" << sensor_time << "\"" << ",";
-
-                    sensor_data_line +=  sensor_interval.fieldValue(1);
-                    sensor_data_line += ",";
-
-                    sensor_interval.nextRow();
+                if (!resolution && history && history->covers(from)) {
+                    // Short charts are served from the recent samples in memory
+                    recent_times.clear();
+                    recent_values.clear();
+
+                    history->copy_since(from, recent_times, recent_values);
+
+                    for (std::size_t j = 0; j < recent_times.size(); ++j) {
+                        sensor_time = format_time(recent_times[j]);
+                        response << "\"" << sensor_time << "\"" << ",";
+
+                        char value[32];
+                        auto n = snprintf(value, sizeof(value), "%g,", recent_values[j]);
+                        sensor_data_line.append(value, n);
+                    }
+                } else {
+                    // Use the coarsest rollup that still fills the chart
+                    CppSQLite3Query sensor_interval = resolution
+                        ? db_exec_query(reader.db(), "select datetime(bucket, 'unixepoch'), round(sum / count, 2) from sensor_rollup "
+                                                  "where fk_sensor=%d and resolution=%d and bucket >= %d order by bucket;", sensor_pk, resolution, from / resolution * resolution)
+                        : db_exec_query(reader.db(), "select datetime(time / 1000, 'unixepoch'), value from sensor_value where fk_sensor=%d and time > %d order by time;", sensor_pk, from * 1000LL);
+
+                    while (!sensor_interval.eof()) {
+                        sensor_time = sensor_interval.fieldValue(0);
+                        response << "\"" << sensor_time << "\"" << ",";
+
+                        sensor_data_line +=  sensor_interval.fieldValue(1);
+                        sensor_data_line += ",";
+
+                        sensor_interval.nextRow();
+                    }
                 }
 
-                response << "], labels: {enabled: false}}, subtitle: {text: '" << sensor_name << " - last " << interval[i] << " hours from " << sensor_time
+                response << "], labels: {enabled: false}}, subtitle: {text: '" << sensor_name << " - last " << interval[i].hours << " hours from " << sensor_time
                          << "', verticalAlign: 'bottom', y: -5}, yAxis: {min: 0, title: {text: '" << sensor_type;
 
                 if (sensor_type == "Temperature") {
@@ -415,7 +678,10 @@ void display_controller::sensor_script(Mongoose::Request& request, Mongoose::Str
 }
 
 void display_controller::actuator_data(Mongoose::Request& request, Mongoose::StreamResponse& response) {
-    request_timer timer("actuator_data");
+    static auto& latency = route_latency("actuator_data");
+    latency_timer timer(latency);
+
+    db_reader reader;
 
     std::string url = request.getUrl();
 
@@ -424,27 +690,29 @@ void display_controller::actuator_data(Mongoose::Request& request, Mongoose::Str
 
     std::string actuator_name(url.begin() + start, url.begin() + end);
 
-    int actuator_pk = db_exec_scalar(get_db(), "select pk_actuator from actuator where name=\"%s\";", actuator_name.c_str());
-
-    CppSQLite3Query actuator_query = db_exec_query(get_db(), "select data from actuator_data where fk_actuator=%d order by time desc limit 1;", actuator_pk);
+    int actuator_pk = db_exec_scalar(reader.db(), "select pk_actuator from actuator where name=\"%s\";", actuator_name.c_str());
 
-    if (!actuator_query.eof()) {
-        std::string actuator_data = actuator_query.fieldValue(0);
+    std::string actuator_data;
 
+    if (last_actuator_value(actuator_pk, actuator_data)) {
         auto div_id = actuator_name;
 
         response << "<div id=\"" << div_id << "\" class=\"tabs\"><ul>"
                  << "<li class=\"title\">Actuator name : " << actuator_name << "</li></ul>" << std::endl
                  << "<ul><li>Last Input : " << actuator_data << "</li>" << std::endl;
 
-        int nbClicks = db_exec_scalar(get_db(), "select count(data) from actuator_data where fk_actuator=%d;", actuator_pk);
-        response << "<li>Number of Inputs : " << nbClicks << "</li></ul>" << std::endl
+        device_stats stats{};
+        get_device_stats(reader.db(), device_kind::ACTUATOR, actuator_pk, stats);
+        response << "<li>Number of Inputs : " << stats.count << "</li></ul>" << std::endl
                  << "</div>" << std::endl;
     }
 }
 
 void display_controller::actuator_script(Mongoose::Request& request, Mongoose::StreamResponse& response) {
-    request_timer timer("actuator_script");
+    static auto& latency = route_latency("actuator_script");
+    latency_timer timer(latency);
+
+    db_reader reader;
 
     std::string url = request.getUrl();
 
@@ -453,19 +721,229 @@ void display_controller::actuator_script(Mongoose::Request& request, Mongoose::S
 
     std::string actuator_name(url.begin() + start, url.begin() + end);
 
-    int actuator_pk = db_exec_scalar(get_db(), "select pk_actuator from actuator where name=\"%s\";", actuator_name.c_str());
+    int actuator_pk = db_exec_scalar(reader.db(), "select pk_actuator from actuator where name=\"%s\";", actuator_name.c_str());
 
-    CppSQLite3Query actuator_query = db_exec_query(get_db(), "select data from actuator_data where fk_actuator=%d order by time desc limit 1;", actuator_pk);
+    std::string actuator_data;
 
-    if (!actuator_query.eof()) {
+    if (last_actuator_value(actuator_pk, actuator_data)) {
         auto div_id = actuator_name;
 
         response << "$('#" << div_id  << "').tabs();" << std::endl;
     }
 }
 
+void display_controller::sensor_history_api(Mongoose::Request& request, Mongoose::StreamResponse& response) {
+    static auto& latency = route_latency("sensor_history_api");
+    latency_timer timer(latency);
+
+    db_reader reader;
+
+    // /api/sensors/{name}/{type}/history
+    std::string url = request.getUrl();
+
+    auto start_name = std::string("/api/sensors/").size();
+    auto end_name = url.find("/", start_name);
+
+    auto start_type = end_name + 1;
+    auto end_type = url.find("/", start_type);
+
+    std::string sensor_name(url.begin() + start_name, url.begin() + end_name);
+    std::string sensor_type(url.begin() + start_type, url.begin() + end_type);
+
+    std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::toupper);
+
+    int sensor_pk = db_exec_scalar(reader.db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor_name.c_str(), sensor_type.c_str());
+
+    response.setHeader("Content-Type", "application/json");
+
+    if (sensor_pk < 0) {
+        response.setCode(404);
+        response << "{\"error\":\"unknown sensor\"}";
+        return;
+    }
+
+    auto range = parse_history_range(request);
+
+    response << "{\"sensor\":";
+    write_json_string(response, sensor_name.c_str());
+    response << ",\"from\":" << range.from << ",\"to\":" << range.to << ",\"step\":" << range.step << ',';
+
+    if (std::find(rollup_resolutions.begin(), rollup_resolutions.end(), range.step) != rollup_resolutions.end()) {
+        // Steps matching a rollup do not read the raw data at all
+        CppSQLite3Query query = db_exec_query(reader.db(),
+            "select bucket, sum / count from sensor_rollup where fk_sensor=%d and resolution=%d and bucket >= %d and bucket < %d order by bucket;",
+            sensor_pk, range.step, range.from / range.step * range.step, range.to);
+
+        write_history(response, query, range.limit, true);
+    } else if (range.step) {
+        CppSQLite3Query query = db_exec_query(reader.db(),
+            "select time / 1000 / %d * %d as bucket, avg(value) from sensor_value "
+            "where fk_sensor=%d and time >= %d and time < %d group by bucket order by bucket;",
+            range.step, range.step, sensor_pk, range.from * 1000LL, range.to * 1000LL);
+
+        write_history(response, query, range.limit, true);
+    } else {
+        CppSQLite3Query query = db_exec_query(reader.db(),
+            "select time / 1000, value from sensor_value where fk_sensor=%d and time >= %d and time < %d order by time;",
+            sensor_pk, range.from * 1000LL, range.to * 1000LL);
+
+        write_history(response, query, range.limit, true);
+    }
+
+    response << '}';
+}
+
+void display_controller::actuator_history_api(Mongoose::Request& request, Mongoose::StreamResponse& response) {
+    static auto& latency = route_latency("actuator_history_api");
+    latency_timer timer(latency);
+
+    db_reader reader;
+
+    // /api/actuators/{name}/history
+    std::string url = request.getUrl();
+
+    auto start = std::string("/api/actuators/").size();
+    auto end = url.find("/", start);
+
+    std::string actuator_name(url.begin() + start, url.begin() + end);
+
+    int actuator_pk = db_exec_scalar(reader.db(), "select pk_actuator from actuator where name=\"%s\";", actuator_name.c_str());
+
+    response.setHeader("Content-Type", "application/json");
+
+    if (actuator_pk < 0) {
+        response.setCode(404);
+        response << "{\"error\":\"unknown actuator\"}";
+        return;
+    }
+
+    auto range = parse_history_range(request);
+
+    response << "{\"actuator\":";
+    write_json_string(response, actuator_name.c_str());
+    response << ",\"from\":" << range.from << ",\"to\":" << range.to << ',';
+
+    if (range.step) {
+        // The events are not numeric, they are counted by step
+        CppSQLite3Query query = db_exec_query(reader.db(),
+            "select cast(strftime('%s', time) as integer) / %d * %d as bucket, count(*) from actuator_data "
+            "where fk_actuator=%d and time >= \"%s\" and time < \"%s\" group by bucket order by bucket;",
+            range.step, range.step, actuator_pk, format_time(range.from).c_str(), format_time(range.to).c_str());
+
+        response << "\"step\":" << range.step << ',';
+        write_history(response, query, range.limit, true);
+    } else {
+        CppSQLite3Query query = db_exec_query(reader.db(),
+            "select cast(strftime('%s', time) as integer), data from actuator_data "
+            "where fk_actuator=%d and time >= \"%s\" and time < \"%s\" order by time;",
+            actuator_pk, format_time(range.from).c_str(), format_time(range.to).c_str());
+
+        response << "\"step\":0,";
+        write_history(response, query, range.limit, false);
+    }
+
+    response << '}';
+}
+
+void display_controller::retention_api(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response) {
+    auto stats = get_retention_stats();
+
+    response.setHeader("Content-Type", "application/json");
+
+    response << "{\"passes\":" << stats.passes
+             << ",\"deleted_rows\":" << stats.deleted_rows
+             << ",\"reclaimed_bytes\":" << stats.reclaimed_bytes
+             << ",\"last_pass_ms\":" << stats.last_pass_ms
+             << ",\"max_step_ms\":" << stats.max_step_ms << "}";
+}
+
+void display_controller::metrics(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response) {
+    response.setHeader("Content-Type", "text/plain; version=0.0.4");
+
+    write_metrics(response);
+
+    // The statistics kept by the modules themselves
+    auto writer = get_db_writer_stats();
+    write_metric(response, "asgard_db_writer_queue_depth", "gauge", "Number of samples waiting to be written", writer.queue_depth);
+    write_metric(response, "asgard_db_writer_written_total", "counter", "Number of samples committed", writer.written);
+    write_metric(response, "asgard_db_writer_dropped_total", "counter", "Number of samples dropped because the queue was full", writer.dropped);
+    write_metric(response, "asgard_db_writer_failed_total", "counter", "Number of samples lost in a failed transaction", writer.failed);
+    write_metric(response, "asgard_db_writer_batches_total", "counter", "Number of committed transactions", writer.batches);
+    write_metric(response, "asgard_db_writer_max_commit_seconds", "gauge", "Longest commit since startup", writer.max_commit_us / 1e6);
+
+    auto statements = get_db_statement_stats();
+    write_metric(response, "asgard_sql_statement_hits_total", "counter", "Number of executions served by a cached statement", statements.hits);
+    write_metric(response, "asgard_sql_statement_misses_total", "counter", "Number of statements compiled", statements.misses);
+
+    auto readers = get_db_reader_stats();
+    write_metric(response, "asgard_db_readers", "gauge", "Number of read-only connections opened", readers.connections);
+    write_metric(response, "asgard_db_reader_fallbacks_total", "counter", "Number of reads served by the writer connection", readers.fallbacks);
+
+    auto executor = get_executor_stats();
+    write_metric(response, "asgard_executor_queue_depth", "gauge", "Number of pending rule tasks", executor.queue_depth);
+    write_metric(response, "asgard_executor_executed_total", "counter", "Number of rule tasks executed", executor.executed);
+    write_metric(response, "asgard_executor_dropped_total", "counter", "Number of rule tasks dropped by the overflow policy", executor.dropped);
+    write_metric(response, "asgard_executor_stolen_total", "counter", "Number of rule tasks executed outside of their home worker", executor.stolen);
+    write_metric(response, "asgard_executor_max_latency_seconds", "gauge", "Longest rule task latency since startup", executor.max_latency_us / 1e6);
+
+    auto retention = get_retention_stats();
+    write_metric(response, "asgard_retention_passes_total", "counter", "Number of complete pruning passes", retention.passes);
+    write_metric(response, "asgard_retention_deleted_rows_total", "counter", "Number of rows deleted by the retention", retention.deleted_rows);
+    write_metric(response, "asgard_retention_reclaimed_bytes_total", "counter", "Bytes given back to the file system", retention.reclaimed_bytes);
+    write_metric(response, "asgard_retention_max_step_seconds", "gauge", "Longest pruning step since startup", retention.max_step_ms / 1e3);
+
+    auto events = get_event_stream_stats();
+    write_metric(response, "asgard_events_published_total", "counter", "Number of live updates published", events.published);
+    write_metric(response, "asgard_events_waiting", "gauge", "Number of web clients waiting for live updates", events.waiting);
+    write_metric(response, "asgard_events_evicted_total", "counter", "Number of web clients evicted because they were too slow", events.evicted);
+}
+
+void display_controller::events(Mongoose::Request& request, Mongoose::StreamResponse& response) {
+    // The responses are only sent once complete: the stream is made of
+    // batches and EventSource asks for the next one with Last-Event-ID
+    response.setHeader("Content-Type", "text/event-stream");
+    response.setHeader("Cache-Control", "no-cache");
+
+    auto cursor = request.getHeaderKeyValue("Last-Event-ID");
+    if (cursor.empty()) {
+        cursor = request.get("since", "");
+    }
+
+    stream_filter filter;
+    filter.sensors   = parse_pk_list(request.get("sensors", ""));
+    filter.actuators = parse_pk_list(request.get("actuators", ""));
+
+    // A new subscriber starts with the next event
+    auto after = cursor.empty() ? last_event_id() : std::strtoull(cursor.c_str(), nullptr, 10);
+
+    stream_batch batch;
+    wait_events(after, filter, max_stream_events, batch);
+
+    response << "retry: " << stream_retry_ms << "\n";
+
+    if (batch.evicted) {
+        response << "id: " << batch.last_id << "\nevent: reset\ndata: {}\n\n";
+        return;
+    }
+
+    for (auto& event : batch.events) {
+        response << "id: " << event.id << "\nevent: " << (event.kind == stream_kind::SENSOR ? "sensor" : "actuator")
+                 << "\ndata: {\"pk\":" << event.device << ",\"time\":" << event.time << ",\"value\":";
+        write_json_string(response, event.value);
+        response << "}\n\n";
+    }
+
+    // The filtered events move the cursor too
+    if (batch.events.empty() || batch.events.back().id != batch.last_id) {
+        response << "id: " << batch.last_id << "\n\n";
+    }
+}
+
 void display_controller::display_actions(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response) {
-    request_timer timer("actions");
+    static auto& latency = route_latency("actions");
+    latency_timer timer(latency);
+
+    db_reader reader;
 
     response << header << std::endl
              << "<div id=\"header\"><center><h2>Asgard - Home Automation System</h2></center></div>" << std::endl
@@ -475,37 +953,19 @@ void display_controller::display_actions(Mongoose::Request& /*request*/, Mongoos
              << "<div id=\"main\"><div class=\"tabs\">" << std::endl
              << "<ul><li class=\"title\">Actions Available</li></ul><ul>" << std::endl;
 
-    for (auto& data : get_db().execQuery("select fk_source, name, type from action;")) {
-        int source_pk           = data.getIntField(0);
-        std::string action_name = data.fieldValue(1);
-        std::string action_type = data.fieldValue(2);
-
-        auto source_query = db_exec_query(get_db(), "select name from source where pk_source=%d;", source_pk);
-        auto source_name  = source_query.fieldValue(0);
-
-        auto action_path       = std::string("/action/") + source_name + "/" + action_name;
-        auto action_descriptor = std::string(source_name) + ":" + action_name;
-
-        response << "\n<li>";
-
-        if (action_type == "SIMPLE") {
-            response << "<form action=\"" << action_path << "\" method=\"GET\">" << action_descriptor << " : <input type=\"submit\" value=\"Execute\"></form>";
-        } else {
-            // For STRING actions, use a input
-            response << "<form action=\"" << action_path << "\" method=\"GET\">" << action_descriptor << " : <input name=\"value\" type=\"text\"><input type=\"submit\" value=\"Execute\"></form>";
-        }
-
-        response << "</li>\n";
-    }
+    display_actions_list(reader.db(), response);
 
     response << "</ul></div></div></div>\n"
              << "<div id=\"footer\">© 2015-2016 Asgard Team. All Rights Reserved.</div></body></html>";
 }
 
 void display_controller::display_rules(Mongoose::Request& /*request*/, Mongoose::StreamResponse& response) {
-    request_timer timer("rules");
+    static auto& latency = route_latency("rules");
+    latency_timer timer(latency);
+
+    db_reader reader;
 
-    std::cout << "DEBUG: asgard: Begin rendering rules" << std::endl;
+    ASGARD_DEBUG << "asgard: Begin rendering rules";
 
     response << header << std::endl
              << "<div id=\"header\"><center><h2>Asgard - Home Automation System</h2></center></div>" << std::endl
@@ -520,7 +980,7 @@ void display_controller::display_rules(Mongoose::Request& /*request*/, Mongoose:
     // Add sensors to the list of sources
 
 
-    for(auto& data : db_exec_query(get_db(), "select pk_sensor, name, type from sensor order by name;")){
+    for(auto& data : db_exec_query(reader.db(), "select pk_sensor, name, type from sensor order by name;")){
         int sensor_pk = data.getIntField(0);
         std::string sensor_name = data.fieldValue(1);
         std::string sensor_type = data.fieldValue(2);
@@ -529,7 +989,7 @@ void display_controller::display_rules(Mongoose::Request& /*request*/, Mongoose:
 
     // Add actuators to the list of sources
 
-    for(auto& data : db_exec_query(get_db(), "select pk_actuator, name from actuator order by name;")){
+    for(auto& data : db_exec_query(reader.db(), "select pk_actuator, name from actuator order by name;")){
         int actuator_pk = data.getIntField(0);
         std::string actuator_name = data.fieldValue(1);
         response << "<OPTION value=\"a" << actuator_pk << "\">" << actuator_name << std::endl;
@@ -557,7 +1017,7 @@ void display_controller::display_rules(Mongoose::Request& /*request*/, Mongoose:
 
     // Add actions to the list of actions
 
-    for(auto& data : db_exec_query(get_db(), "select pk_action, name, type from action order by name;")){
+    for(auto& data : db_exec_query(reader.db(), "select pk_action, name, type from action order by name;")){
         int action_pk = data.getIntField(0);
         std::string action_name = data.fieldValue(1);
         std::string action_type = data.fieldValue(2);
@@ -580,82 +1040,46 @@ void display_controller::display_rules(Mongoose::Request& /*request*/, Mongoose:
 
     // Fill the table of rules
 
-    for(auto& rule_data : db_exec_query(get_db(), "select fk_condition, fk_action, system_action, value from rule;")){
-        int fk_condition = rule_data.getIntField(0);
-        int fk_action = rule_data.getIntField(1);
-        int system_action = rule_data.getIntField(2);
-        std::string rule_value = rule_data.fieldValue(3);
-
-        CppSQLite3Query condition_query = db_exec_query(get_db(), "select operator, value, fk_sensor, fk_actuator from condition where pk_condition = %d;", fk_condition);
-
-        if(condition_query.eof()){
-            std::cerr << "Invalid link in database pk_condition <> fk_condition" << std::endl;
-            break;
-        }
+    display_rules_table(reader.db(), response);
 
-        std::string condition_operator = condition_query.fieldValue(0);
-        std::string condition_value = condition_query.fieldValue(1);
-        int sensor_fk = condition_query.getIntField(2);
-        int actuator_fk = condition_query.getIntField(3);
+    response << "</table></li></ul></div>" << std::endl;
 
-        // Get the source event (actuator or sensor)
+    // Display the rules waiting for a sleep to finish
 
-        if(sensor_fk == 0){
-            CppSQLite3Query actuator_query = db_exec_query(get_db(), "select name from actuator where pk_actuator=%d;", actuator_fk);
+    auto delayed = list_delayed_rules();
 
-            if(actuator_query.eof()){
-                std::cerr << "Invalid link in database pk_actuator <> fk_actuator" << std::endl;
-                break;
-            }
+    if(!delayed.empty()){
+        response << "<div class=\"tabs\"><ul>" << std::endl
+                 << "<li class=\"title\">Delayed Rules</li></ul>" << std::endl
+                 << "<ul style=\"list-style-type: none;\"><li><table cellpadding=8>" << std::endl
+                 << "<tr><th>Due</th><th>Rules</th><th>&nbsp;</th></tr>" << std::endl;
 
-            std::string actuator_name = actuator_query.fieldValue(0);
-            response << "<tr><td>" << actuator_name << "</td><td>&nbsp;</td><td width=\"200px\">&nbsp;</td>" << std::endl;
-        } else if (actuator_fk == 0){
-            CppSQLite3Query sensor_query = db_exec_query(get_db(), "select name, type from sensor where pk_sensor=%d;", sensor_fk);
+        for(auto& pending : delayed){
+            response << "<tr><td>" << format_time(pending.due) << "</td><td>";
 
-            if(sensor_query.eof()){
-                std::cerr << "Invalid link in database pk_actuator <> fk_actuator" << std::endl;
-                break;
+            for(auto rule : pending.rules){
+                response << rule << " ";
             }
 
-            std::string sensor_name = sensor_query.fieldValue(0);
-            std::string sensor_type = sensor_query.fieldValue(1);
-            response << "<tr><td>" << sensor_name << " (" << sensor_type << ")</td><td>" << condition_operator << "</td><td td width=\"80px\">" << condition_value << "</td>" << std::endl;
+            response << "</td><td><form action=\"/cancel_delayed\" method=\"GET\"><input name=\"id\" type=\"hidden\" value=\"" << pending.id
+                     << "\"><input type=\"submit\" value=\"Cancel\"></form></td></tr>" << std::endl;
         }
 
-        // Get the action
-
-        if(fk_action){
-            CppSQLite3Query do_query = db_exec_query(get_db(), "select name, type from action where pk_action=%d;", fk_action);
-
-            if(do_query.eof()){
-                std::cerr << "Invalid link in database pk_action <> fk_action" << std::endl;
-                break;
-            }
-
-            std::string do_name = do_query.fieldValue(0);
-            std::string do_type = do_query.fieldValue(1);
-            response << "<td>" << do_name << " (" << do_type << ")</td><td>" << rule_value << "</td></tr>" << std::endl;
-        } else if(system_action){
-            if(system_action == 1){
-                response << "<td>sleep (system)</td><td>" << rule_value << "</td></tr>" << std::endl;
-            } else {
-                std::cerr << "Invalid system action: " << system_action << std::endl;
-                break;
-            }
-        }
+        response << "</table></li></ul></div>" << std::endl;
     }
 
-    response << "</table></li></ul></div></div></div>" << std::endl
+    response << "</div></div>" << std::endl
              << "<div id=\"footer\">© 2015-2016 Asgard Team. All Rights Reserved.</div></body></html>" << std::endl;
 
-    std::cout << "DEBUG: asgard: End rendering rules" << std::endl;
+    ASGARD_DEBUG << "asgard: End rendering rules";
 }
 
 void display_controller::action(Mongoose::Request& request, Mongoose::StreamResponse& response) {
+    db_reader reader;
+
     std::string url = request.getUrl();
 
-    std::cout << "DEBUG: asgard: start executing action: " << url << std::endl;
+    ASGARD_DEBUG << "asgard: start executing action: " << url;
 
     auto start_source = url.find("/", 1) + 1;
     auto end_source = url.find("/", start_source);
@@ -666,7 +1090,7 @@ void display_controller::action(Mongoose::Request& request, Mongoose::StreamResp
     std::string source_name(url.begin() + start_source, url.begin() + end_source);
     std::string action_name(url.begin() + start_action, url.begin() + end_action);
 
-    CppSQLite3Query source_query = db_exec_query(get_db(), "select pk_source from source where name=\"%s\";", source_name.c_str());
+    CppSQLite3Query source_query = db_exec_query(reader.db(), "select pk_source from source where name=\"%s\";", source_name.c_str());
 
     if(!source_query.eof()){
         int pk_source = source_query.getIntField(0);
@@ -674,11 +1098,11 @@ void display_controller::action(Mongoose::Request& request, Mongoose::StreamResp
         // Make sure the source driver is active
 
         if(!source_sql_exists(pk_source)){
-            std::cerr << "ERROR: asgard: The source for the action is not active" << std::endl;
+            ASGARD_ERROR << "asgard: The source for the action is not active";
             return;
         }
 
-        CppSQLite3Query action_query = db_exec_query(get_db(), "select type from action where name=\"%s\" and fk_source=%d;", action_name.c_str(), pk_source);
+        CppSQLite3Query action_query = db_exec_query(reader.db(), "select type from action where name=\"%s\" and fk_source=%d;", action_name.c_str(), pk_source);
 
         if(!action_query.eof()){
             std::string action_type = action_query.fieldValue(0);
@@ -690,10 +1114,10 @@ void display_controller::action(Mongoose::Request& request, Mongoose::StreamResp
                 send_to_driver(client_addr, "ACTION " + action_name + " " + request.get("value"));
             }
         } else {
-            std::cerr << "ERROR: asgard: Cannot find action in DB for name= " << action_name << " and fk_source=" << pk_source << std::endl;
+            ASGARD_ERROR << "asgard: Cannot find action in DB for name= " << action_name << " and fk_source=" << pk_source;
         }
     } else {
-        std::cerr << "ERROR: asgard: Cannot find source in DB for name= " << source_name << std::endl;
+        ASGARD_ERROR << "asgard: Cannot find source in DB for name= " << source_name;
     }
 
     response << "<!DOCTYPE HTML><html>" << std::endl
@@ -715,17 +1139,17 @@ void display_controller::add_rule(Mongoose::Request& request, Mongoose::StreamRe
     if(source[0] == 's'){
         if (!db_exec_dml(get_db(), "insert into condition(operator, value, fk_sensor) select \"%s\",\"%s\", %d;",
                         symbole.c_str(), condition_value.c_str(), std::atoi(std::string(source.begin() + 1, source.end()).c_str()))) {
-            std::cerr << "ERROR: asgard:: Failed to insert into condition (sensor)" << std::endl;
+            ASGARD_ERROR << "asgard: Failed to insert into condition (sensor)";
             valid = false;
         }
     } else if(source[0] == 'a'){
         if (!db_exec_dml(get_db(), "insert into condition(operator, value, fk_actuator) select \"%s\",\"%s\", %d;",
                          symbole.c_str(), condition_value.c_str(), std::atoi(std::string(source.begin() + 1, source.end()).c_str()))) {
-            std::cerr << "ERROR: asgard:: Failed to insert into condition (actuator)" << std::endl;
+            ASGARD_ERROR << "asgard: Failed to insert into condition (actuator)";
             valid = false;
         }
     } else {
-        std::cerr << "ERROR: asgard: Invalid source (add_rule)" << std::endl;
+        ASGARD_ERROR << "asgard: Invalid source (add_rule)";
         valid = false;
     }
 
@@ -740,7 +1164,7 @@ void display_controller::add_rule(Mongoose::Request& request, Mongoose::StreamRe
             if (!db_exec_dml(get_db(),
                     "insert into rule(value, fk_action, fk_condition) select \"%s\", %d, %d ;",
                     action_value.c_str(), std::atoi(std::string(action.begin() + 1, action.end()).c_str()), condition_pk)) {
-                std::cerr << "ERROR: asgard:: Failed to insert into rule" << std::endl;
+                ASGARD_ERROR << "asgard: Failed to insert into rule";
             }
         }
         // Handle system action
@@ -748,11 +1172,14 @@ void display_controller::add_rule(Mongoose::Request& request, Mongoose::StreamRe
             if (!db_exec_dml(get_db(),
                     "insert into rule(value, system_action, fk_condition) select \"%s\", %d, %d ;",
                     action_value.c_str(), std::atoi(std::string(action.begin() + 1, action.end()).c_str()), condition_pk)) {
-                std::cerr << "ERROR: asgard:: Failed to insert into rule" << std::endl;
+                ASGARD_ERROR << "asgard: Failed to insert into rule";
             }
         }
+
+        // Recompile the rule index
+        reload_rules();
     } else {
-        std::cerr << "ERROR: asgard: Invalid action (add_rule)" << std::endl;
+        ASGARD_ERROR << "asgard: Invalid action (add_rule)";
     }
 
     response << "<!DOCTYPE HTML><html>" << std::endl
@@ -763,8 +1190,25 @@ void display_controller::add_rule(Mongoose::Request& request, Mongoose::StreamRe
              << "</body></html>" << std::endl;
 }
 
+void display_controller::cancel_delayed(Mongoose::Request& request, Mongoose::StreamResponse& response) {
+    auto id = std::atoi(request.get("id").c_str());
+
+    if(!cancel_delayed_rules(id)){
+        ASGARD_ERROR << "asgard: No delayed rules with id " << id;
+    }
+
+    response << "<!DOCTYPE HTML><html>" << std::endl
+             << "<head><meta charset=\"UTF-8\"><meta http-equiv=\"refresh\">" << std::endl
+             << "<script type=\"text/javascript\">window.location.href=\"/rules\"</script>" << std::endl
+             << "<title>Page Redirection</title></head>" << std::endl
+             << "<body>If you are not redirected automatically, follow the <a href='/rules'>following link</a>" << std::endl
+             << "</body></html>" << std::endl;
+}
+
 //This will be called automatically
 void display_controller::display_controller::setup() {
+    db_reader reader;
+
     addRoute<display_controller>("GET", "/", &display_controller::display);
     addRoute<display_controller>("GET", "/display", &display_controller::display);
     addRoute<display_controller>("GET", "/led_on", &display_controller::led_on);
@@ -773,22 +1217,28 @@ void display_controller::display_controller::setup() {
     addRoute<display_controller>("GET", "/actions", &display_controller::display_actions);
     addRoute<display_controller>("GET", "/rules", &display_controller::display_rules);
     addRoute<display_controller>("GET", "/addrule", &display_controller::add_rule);
+    addRoute<display_controller>("GET", "/cancel_delayed", &display_controller::cancel_delayed);
+    addRoute<display_controller>("GET", "/api/retention", &display_controller::retention_api);
+    addRoute<display_controller>("GET", "/metrics", &display_controller::metrics);
+    addRoute<display_controller>("GET", "/events", &display_controller::events);
 
     //TODO The routes should be added dynamically when we register a new source or sensor or actuator
     //Otherwise the new sensors will not show unless we restart the server
 
     try {
         // Register the sensor data and script pages
-        for(auto& data : get_db().execQuery("select name, type, pk_sensor from sensor order by name;")){
+        for(auto& data : reader.db().execQuery("select name, type, pk_sensor from sensor order by name;")){
             std::string sensor_name = data.fieldValue(0);
             std::string sensor_type = data.fieldValue(1);
             int sensor_pk = data.getIntField(2);
 
-            CppSQLite3Query sensor_data = db_exec_query(get_db(), "select data from sensor_data where fk_sensor=%d order by time desc limit 1;", sensor_pk);
+            std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
+
+            addRoute<display_controller>("GET", "/api/sensors/" + sensor_name + "/" + sensor_type + "/history", &display_controller::sensor_history_api);
 
-            if (!sensor_data.eof()) {
-                std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
+            std::string sensor_data;
 
+            if (last_sensor_value(sensor_pk, sensor_data)) {
                 std::string url = "/" + sensor_name + "/" + sensor_type;
                 addRoute<display_controller>("GET", url + "/data", &display_controller::sensor_data);
                 addRoute<display_controller>("GET", url + "/script", &display_controller::sensor_script);
@@ -796,18 +1246,20 @@ void display_controller::display_controller::setup() {
         }
 
         // Register the actuator data and script pages
-        for(auto& data : get_db().execQuery("select name, pk_actuator from actuator order by name;")){
+        for(auto& data : reader.db().execQuery("select name, pk_actuator from actuator order by name;")){
             std::string url = std::string("/") + data.fieldValue(0);
             int actuator_pk = data.getIntField(1);
 
-            CppSQLite3Query actuator_data = db_exec_query(get_db(), "select data from actuator_data where fk_actuator=%d order by time desc limit 1;", actuator_pk);
+            addRoute<display_controller>("GET", "/api/actuators" + url + "/history", &display_controller::actuator_history_api);
+
+            std::string actuator_data;
 
-            if (!actuator_data.eof()) {
+            if (last_actuator_value(actuator_pk, actuator_data)) {
                 addRoute<display_controller>("GET", url + "/data", &display_controller::actuator_data);
                 addRoute<display_controller>("GET", url + "/script", &display_controller::actuator_script);
             }
         }
     } catch (CppSQLite3Exception& e){
-        std::cerr << e.errorCode() << ":" << e.errorMessage() << std::endl;
+        ASGARD_ERROR << e.errorCode() << ":" << e.errorMessage();
     }
 }
@@ -0,0 +1,104 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <iostream>
+
+#include <cstring>
+
+#include "display_tables.hpp"
+#include "logger.hpp"
+
+void display_rules_table(CppSQLite3DB& db, std::ostream& response){
+    // The conditions, devices and actions are left joined to detect the invalid links
+    CppSQLite3Query rule_query = db.execQuery(
+        "select rule.fk_action, rule.system_action, rule.value, condition.pk_condition, condition.operator, condition.value, "
+        "condition.fk_sensor, condition.fk_actuator, sensor.name, sensor.type, actuator.name, action.name, action.type "
+        "from rule "
+        "left join condition on condition.pk_condition = rule.fk_condition "
+        "left join sensor on sensor.pk_sensor = condition.fk_sensor "
+        "left join actuator on actuator.pk_actuator = condition.fk_actuator "
+        "left join action on action.pk_action = rule.fk_action "
+        "order by rule.pk_rule;");
+
+    for (; !rule_query.eof(); rule_query.nextRow()) {
+        int fk_action = rule_query.getIntField(0);
+        int system_action = rule_query.getIntField(1);
+        const char* rule_value = rule_query.fieldValue(2);
+
+        if (rule_query.fieldIsNull(3)) {
+            ASGARD_ERROR << "Invalid link in database pk_condition <> fk_condition";
+            break;
+        }
+
+        const char* condition_operator = rule_query.fieldValue(4);
+        const char* condition_value = rule_query.fieldValue(5);
+        int sensor_fk = rule_query.getIntField(6);
+        int actuator_fk = rule_query.getIntField(7);
+
+        // The source event (actuator or sensor)
+
+        if (sensor_fk == 0) {
+            if (rule_query.fieldIsNull(10)) {
+                ASGARD_ERROR << "Invalid link in database pk_actuator <> fk_actuator";
+                break;
+            }
+
+            response << "<tr><td>" << rule_query.fieldValue(10) << "</td><td>&nbsp;</td><td width=\"200px\">&nbsp;</td>" << std::endl;
+        } else if (actuator_fk == 0) {
+            if (rule_query.fieldIsNull(8)) {
+                ASGARD_ERROR << "Invalid link in database pk_sensor <> fk_sensor";
+                break;
+            }
+
+            response << "<tr><td>" << rule_query.fieldValue(8) << " (" << rule_query.fieldValue(9) << ")</td><td>" << condition_operator
+                     << "</td><td td width=\"80px\">" << condition_value << "</td>" << std::endl;
+        }
+
+        // The action
+
+        if (fk_action) {
+            if (rule_query.fieldIsNull(11)) {
+                ASGARD_ERROR << "Invalid link in database pk_action <> fk_action";
+                break;
+            }
+
+            response << "<td>" << rule_query.fieldValue(11) << " (" << rule_query.fieldValue(12) << ")</td><td>" << rule_value << "</td></tr>" << std::endl;
+        } else if (system_action) {
+            if (system_action == 1) {
+                response << "<td>sleep (system)</td><td>" << rule_value << "</td></tr>" << std::endl;
+            } else {
+                ASGARD_ERROR << "Invalid system action: " << system_action;
+                break;
+            }
+        }
+    }
+}
+
+void display_actions_list(CppSQLite3DB& db, std::ostream& response){
+    CppSQLite3Query action_query = db.execQuery(
+        "select source.name, action.name, action.type from action "
+        "join source on source.pk_source = action.fk_source order by action.pk_action;");
+
+    for (; !action_query.eof(); action_query.nextRow()) {
+        const char* source_name = action_query.fieldValue(0);
+        const char* action_name = action_query.fieldValue(1);
+        const char* action_type = action_query.fieldValue(2);
+
+        response << "\n<li>";
+
+        if (std::strcmp(action_type, "SIMPLE") == 0) {
+            response << "<form action=\"/action/" << source_name << "/" << action_name << "\" method=\"GET\">"
+                     << source_name << ":" << action_name << " : <input type=\"submit\" value=\"Execute\"></form>";
+        } else {
+            // For STRING actions, use a input
+            response << "<form action=\"/action/" << source_name << "/" << action_name << "\" method=\"GET\">"
+                     << source_name << ":" << action_name << " : <input name=\"value\" type=\"text\"><input type=\"submit\" value=\"Execute\"></form>";
+        }
+
+        response << "</li>\n";
+    }
+}
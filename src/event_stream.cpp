@@ -0,0 +1,148 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+
+#include "event_stream.hpp"
+
+namespace {
+
+std::chrono::milliseconds hold(15000);
+std::size_t max_waiting = 2;
+
+// A single lock protects the ring, the events are small and copied out
+std::mutex lock;
+std::condition_variable published;
+
+std::array<stream_event, event_stream_capacity> ring;
+
+std::uint64_t next_id = 1; ///< Id of the next event, ring[id % capacity]
+
+event_stream_stats stats{};
+
+bool contains(const std::vector<std::size_t>& devices, std::size_t device){
+    return std::find(devices.begin(), devices.end(), device) != devices.end();
+}
+
+// Must be called with the lock held
+void copy_events(std::uint64_t after, const stream_filter& filter, std::size_t max_events, stream_batch& batch){
+    auto oldest = next_id > event_stream_capacity ? next_id - event_stream_capacity : 1;
+
+    if(after + 1 < oldest){
+        batch.evicted = true;
+        batch.last_id = next_id - 1;
+        ++stats.evicted;
+        return;
+    }
+
+    auto id = after + 1;
+
+    for(; id < next_id && batch.events.size() < max_events; ++id){
+        auto& event = ring[id % event_stream_capacity];
+
+        if(filter.accepts(event)){
+            batch.events.push_back(event);
+        }
+    }
+
+    batch.last_id = id - 1;
+}
+
+} //end of anonymous namespace
+
+bool stream_filter::accepts(const stream_event& event) const {
+    if(sensors.empty() && actuators.empty()){
+        return true;
+    }
+
+    return contains(event.kind == stream_kind::SENSOR ? sensors : actuators, event.device);
+}
+
+void configure_event_stream(std::chrono::milliseconds hold_time, std::size_t waiting){
+    std::lock_guard<std::mutex> l(lock);
+
+    hold        = hold_time;
+    max_waiting = waiting;
+}
+
+void publish_event(stream_kind kind, std::size_t device, const char* value, std::size_t size){
+    size = std::min(size, max_sample_size);
+
+    std::size_t waiting;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        auto& event = ring[next_id % event_stream_capacity];
+
+        event.id     = next_id;
+        event.kind   = kind;
+        event.device = device;
+        event.time   = std::time(nullptr);
+        event.size   = size;
+        std::memcpy(event.value, value, size);
+        event.value[size] = '\0';
+
+        ++next_id;
+        ++stats.published;
+
+        waiting = stats.waiting;
+    }
+
+    // Nobody to wake up most of the time
+    if(waiting){
+        published.notify_all();
+    }
+}
+
+std::uint64_t last_event_id(){
+    std::lock_guard<std::mutex> l(lock);
+    return next_id - 1;
+}
+
+void wait_events(std::uint64_t after, const stream_filter& filter, std::size_t max_events, stream_batch& batch){
+    batch.evicted = false;
+    batch.events.clear();
+
+    std::unique_lock<std::mutex> l(lock);
+
+    // The cursor of a subscriber can be ahead after a restart of the server
+    if(after >= next_id){
+        after = next_id - 1;
+    }
+
+    copy_events(after, filter, max_events, batch);
+
+    if(batch.evicted || !batch.events.empty() || stats.waiting >= max_waiting){
+        return;
+    }
+
+    // Wait for an event accepted by the filter
+    auto deadline = std::chrono::steady_clock::now() + hold;
+
+    ++stats.waiting;
+
+    while(batch.events.empty() && !batch.evicted){
+        if(published.wait_until(l, deadline) == std::cv_status::timeout){
+            copy_events(batch.last_id, filter, max_events, batch);
+            break;
+        }
+
+        copy_events(batch.last_id, filter, max_events, batch);
+    }
+
+    --stats.waiting;
+}
+
+event_stream_stats get_event_stream_stats(){
+    std::lock_guard<std::mutex> l(lock);
+    return stats;
+}
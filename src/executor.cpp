@@ -0,0 +1,214 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "executor.hpp"
+#include "logger.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct task_t {
+    std::function<void()> function;
+    clock_type::time_point submitted;
+};
+
+struct shard_t {
+    std::deque<task_t> tasks;
+    bool busy = false; ///< A worker is executing a task of this shard
+};
+
+std::size_t capacity;
+overflow_policy policy;
+
+// A single lock protects the shards, the tasks themselves run unlocked
+std::mutex lock;
+std::condition_variable work_ready;
+std::condition_variable room_ready;
+
+std::vector<shard_t> shards;
+std::vector<std::thread> workers;
+
+// Read by the workers while the threads are being started, guarded by lock
+std::size_t worker_count = 0;
+bool stopping = false;
+
+executor_stats stats{};
+
+// Find a shard with pending work and no running task, starting with the home shard
+bool acquire_shard(std::size_t worker, std::size_t& selected){
+    auto n = shards.size();
+
+    for(std::size_t i = 0; i < n; ++i){
+        auto s = (worker + i) % n;
+
+        if(!shards[s].busy && !shards[s].tasks.empty()){
+            selected = s;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void worker_loop(std::size_t worker){
+    std::unique_lock<std::mutex> l(lock);
+
+    while(true){
+        std::size_t s = 0;
+
+        work_ready.wait(l, [&]{ return stopping || acquire_shard(worker, s); });
+
+        if(!acquire_shard(worker, s)){
+            // Stopping and nothing left to execute
+            return;
+        }
+
+        auto& shard = shards[s];
+
+        auto task = std::move(shard.tasks.front());
+        shard.tasks.pop_front();
+        shard.busy = true;
+
+        --stats.queue_depth;
+
+        if(s % worker_count != worker){
+            ++stats.stolen;
+        }
+
+        room_ready.notify_all();
+
+        l.unlock();
+
+        try {
+            task.function();
+        } catch (...) {
+            ASGARD_ERROR << "asgard: executor: task failed";
+        }
+
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - task.submitted).count();
+
+        l.lock();
+
+        shard.busy = false;
+
+        ++stats.executed;
+        stats.last_latency_us = us;
+        stats.max_latency_us  = std::max<std::size_t>(stats.max_latency_us, us);
+
+        // The next task of the shard can now be picked by any worker
+        if(!shard.tasks.empty()){
+            work_ready.notify_one();
+        }
+    }
+}
+
+bool submit(std::size_t key, std::function<void()> function, bool may_wait){
+    std::unique_lock<std::mutex> l(lock);
+
+    if(stopping || !worker_count){
+        return false;
+    }
+
+    auto& shard = shards[key % shards.size()];
+
+    if(shard.tasks.size() >= capacity){
+        // The callers that must not wait drop the new task instead of blocking
+        if(policy == overflow_policy::DROP_NEWEST || (policy == overflow_policy::BLOCK && !may_wait)){
+            ++stats.dropped;
+            return false;
+        } else if(policy == overflow_policy::DROP_OLDEST){
+            shard.tasks.pop_front();
+            --stats.queue_depth;
+            ++stats.dropped;
+        } else {
+            room_ready.wait(l, [&]{ return stopping || shard.tasks.size() < capacity; });
+
+            if(stopping){
+                return false;
+            }
+        }
+    }
+
+    shard.tasks.push_back({std::move(function), clock_type::now()});
+    ++stats.queue_depth;
+
+    l.unlock();
+
+    work_ready.notify_one();
+
+    return true;
+}
+
+} //end of anonymous namespace
+
+overflow_policy parse_overflow_policy(const std::string& policy){
+    if(policy == "drop_newest"){
+        return overflow_policy::DROP_NEWEST;
+    } else if(policy == "block"){
+        return overflow_policy::BLOCK;
+    }
+
+    return overflow_policy::DROP_OLDEST;
+}
+
+void start_executor(std::size_t n_workers, std::size_t n_shards, std::size_t shard_capacity, overflow_policy overflow){
+    std::lock_guard<std::mutex> l(lock);
+
+    capacity = shard_capacity;
+    policy   = overflow;
+
+    shards.resize(std::max(n_shards, n_workers));
+
+    // The workers only run once the lock is released, with all of them known
+    worker_count = n_workers;
+
+    for(std::size_t i = 0; i < n_workers; ++i){
+        workers.emplace_back(worker_loop, i);
+    }
+}
+
+void stop_executor(){
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+
+    work_ready.notify_all();
+    room_ready.notify_all();
+
+    // The pending tasks are executed before the workers exit
+    for(auto& worker : workers){
+        worker.join();
+    }
+
+    std::lock_guard<std::mutex> l(lock);
+
+    workers.clear();
+    worker_count = 0;
+}
+
+bool execute_task(std::size_t key, std::function<void()> function){
+    return submit(key, std::move(function), true);
+}
+
+bool try_execute_task(std::size_t key, std::function<void()> function){
+    return submit(key, std::move(function), false);
+}
+
+executor_stats get_executor_stats(){
+    std::lock_guard<std::mutex> l(lock);
+    return stats;
+}
@@ -0,0 +1,69 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+
+#include <ctime>
+
+#include "fragment_cache.hpp"
+
+namespace {
+
+struct fragment_t {
+    std::size_t version;
+    std::shared_ptr<const std::string> html;
+};
+
+std::atomic<std::size_t> version{1};
+
+// The versions restart at each launch, the start time disambiguates the tags
+const std::time_t epoch = std::time(nullptr);
+
+std::mutex fragments_lock;
+std::unordered_map<std::string, fragment_t> fragments;
+
+} //end of anonymous namespace
+
+void invalidate_fragments(){
+    ++version;
+}
+
+std::string fragments_etag(){
+    return "\"" + std::to_string(epoch) + "-" + std::to_string(version.load()) + "\"";
+}
+
+std::shared_ptr<const std::string> cached_fragment(const std::string& name, const std::function<void(std::ostream&)>& render){
+    // Read the version first, an invalidation during the rendering forces a new one next time
+    auto current = version.load();
+
+    {
+        std::lock_guard<std::mutex> l(fragments_lock);
+
+        auto it = fragments.find(name);
+        if(it != fragments.end() && it->second.version == current){
+            return it->second.html;
+        }
+    }
+
+    // Rendered without the lock, two concurrent renderings are harmless
+    std::ostringstream out;
+    render(out);
+
+    auto html = std::make_shared<const std::string>(out.str());
+
+    std::lock_guard<std::mutex> l(fragments_lock);
+
+    auto& fragment = fragments[name];
+    if(fragment.version <= current){
+        fragment = {current, html};
+    }
+
+    return html;
+}
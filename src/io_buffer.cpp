@@ -0,0 +1,108 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <algorithm>
+
+#include <cerrno>
+#include <climits>
+
+#include <sys/uio.h>
+
+#include "io_buffer.hpp"
+
+namespace {
+
+const std::size_t max_pooled_buffers  = 64;
+const std::size_t max_pooled_capacity = 64 * 1024;
+const std::size_t max_iovecs          = std::min<std::size_t>(64, IOV_MAX);
+
+// Buffers released on a thread are reused by the same thread
+thread_local std::vector<std::unique_ptr<io_buffer>> pool;
+
+} //end of anonymous namespace
+
+void io_buffer_releaser::operator()(io_buffer* buffer) const {
+    std::unique_ptr<io_buffer> owned(buffer);
+
+    // Oversized buffers are not kept, a single large message must not pin memory
+    if(pool.size() < max_pooled_buffers && buffer->data.capacity() <= max_pooled_capacity){
+        buffer->data.clear();
+        buffer->offset = 0;
+        pool.push_back(std::move(owned));
+    }
+}
+
+pooled_buffer acquire_buffer(){
+    if(pool.empty()){
+        return pooled_buffer(new io_buffer);
+    }
+
+    auto buffer = pool.back().release();
+    pool.pop_back();
+
+    return pooled_buffer(buffer);
+}
+
+bool send_queue::push(const char* data, std::size_t size){
+    if(bytes + size > max_bytes){
+        return false;
+    }
+
+    auto buffer = acquire_buffer();
+    buffer->data.assign(data, data + size);
+
+    pending.push_back(std::move(buffer));
+    bytes += size;
+
+    return true;
+}
+
+send_queue::status send_queue::flush(int socket_fd){
+    while(!pending.empty()){
+        struct iovec iov[max_iovecs];
+
+        std::size_t count = 0;
+        for(auto& buffer : pending){
+            if(count == max_iovecs){
+                break;
+            }
+
+            iov[count].iov_base = buffer->data.data() + buffer->offset;
+            iov[count].iov_len  = buffer->data.size() - buffer->offset;
+            ++count;
+        }
+
+        auto n = writev(socket_fd, iov, count);
+
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+
+            return errno == EAGAIN || errno == EWOULDBLOCK ? status::PENDING : status::FAILED;
+        }
+
+        bytes -= n;
+
+        // Release the complete messages, remember the position in the partial one
+        std::size_t written = n;
+        while(written){
+            auto& front = pending.front();
+            auto left = front->data.size() - front->offset;
+
+            if(written < left){
+                front->offset += written;
+                break;
+            }
+
+            written -= left;
+            pending.pop_front();
+        }
+    }
+
+    return status::FLUSHED;
+}
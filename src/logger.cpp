@@ -0,0 +1,250 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include <cstring>
+#include <cstdlib>
+
+#include "logger.hpp"
+#include "metrics.hpp"
+
+namespace {
+
+// Number of records a thread can have pending before they are dropped
+constexpr std::size_t ring_capacity = 128;
+
+// Time the logger sleeps when the rings are empty
+const std::chrono::milliseconds idle_time(20);
+
+struct log_record {
+    std::uint64_t sequence;
+    log_level level;
+    std::size_t size;
+    char message[max_log_message];
+};
+
+// Single producer (the owning thread), single consumer (the logger)
+struct log_ring {
+    std::atomic<std::uint64_t> head{0}; ///< Next record to write, owned by the producer
+    std::atomic<std::uint64_t> tail{0}; ///< Next record to read, owned by the logger
+    std::atomic<bool> abandoned{false}; ///< The producer thread exited
+    log_record records[ring_capacity];
+};
+
+std::atomic<int> runtime_level{static_cast<int>(log_level::INFO)};
+
+// Orders the records of the different threads
+std::atomic<std::uint64_t> sequence{0};
+
+std::atomic<bool> running{false};
+std::atomic<bool> stopping{false};
+std::thread logger_thread;
+
+std::mutex rings_lock;
+std::vector<std::shared_ptr<log_ring>> rings;
+
+metric_counter& dropped(){
+    static auto& dropped = get_counter("asgard_log_dropped_total", "Number of log records dropped because a ring was full");
+    return dropped;
+}
+
+// The ring is registered on the first record of the thread
+struct thread_ring {
+    std::shared_ptr<log_ring> ring;
+
+    thread_ring() : ring(std::make_shared<log_ring>()) {
+        std::lock_guard<std::mutex> l(rings_lock);
+        rings.push_back(ring);
+    }
+
+    ~thread_ring(){
+        // The logger drains the remaining records before releasing it
+        ring->abandoned.store(true, std::memory_order_release);
+    }
+};
+
+thread_local thread_ring local_ring;
+
+const char* level_prefix(log_level level){
+    switch(level){
+        case log_level::DEBUG:
+            return "DEBUG: ";
+        case log_level::WARNING:
+            return "WARNING: ";
+        case log_level::ERROR:
+            return "ERROR: ";
+        default:
+            return "";
+    }
+}
+
+void write_record(log_level level, const char* message, std::size_t size){
+    auto stream = level >= log_level::WARNING ? stderr : stdout;
+
+    std::fputs(level_prefix(level), stream);
+    std::fwrite(message, 1, size, stream);
+    std::fputc('\n', stream);
+}
+
+// Move the pending records of all the rings, return false if there were none
+bool drain(std::vector<log_record>& records){
+    records.clear();
+
+    std::lock_guard<std::mutex> l(rings_lock);
+
+    for(auto& ring : rings){
+        // Read the flag first, the records pushed before the exit are seen
+        auto abandoned = ring->abandoned.load(std::memory_order_acquire);
+
+        auto tail = ring->tail.load(std::memory_order_relaxed);
+        auto head = ring->head.load(std::memory_order_acquire);
+
+        for(auto i = tail; i < head; ++i){
+            records.push_back(ring->records[i % ring_capacity]);
+        }
+
+        ring->tail.store(head, std::memory_order_release);
+
+        if(abandoned){
+            ring.reset();
+        }
+    }
+
+    rings.erase(std::remove(rings.begin(), rings.end(), nullptr), rings.end());
+
+    return !records.empty();
+}
+
+void logger_loop(){
+    std::vector<log_record> records;
+    records.reserve(ring_capacity);
+
+    std::size_t reported = 0;
+
+    while(true){
+        auto stop = stopping.load();
+
+        if(drain(records)){
+            std::sort(records.begin(), records.end(), [](const log_record& lhs, const log_record& rhs){ return lhs.sequence < rhs.sequence; });
+
+            for(auto& record : records){
+                write_record(record.level, record.message, record.size);
+            }
+        }
+
+        auto lost = get_log_dropped();
+        if(lost != reported){
+            char message[64];
+            auto n = std::snprintf(message, sizeof(message), "asgard: log: %zu records dropped", lost - reported);
+            write_record(log_level::WARNING, message, n);
+            reported = lost;
+        }
+
+        // A single flush for the whole batch
+        std::fflush(stdout);
+        std::fflush(stderr);
+
+        if(stop){
+            break;
+        }
+
+        if(records.empty()){
+            std::this_thread::sleep_for(idle_time);
+        }
+    }
+}
+
+} //end of anonymous namespace
+
+void set_log_level(log_level level){
+    runtime_level = static_cast<int>(level);
+}
+
+log_level parse_log_level(const std::string& level, log_level default_level){
+    if(level == "debug"){
+        return log_level::DEBUG;
+    } else if(level == "info"){
+        return log_level::INFO;
+    } else if(level == "warning"){
+        return log_level::WARNING;
+    } else if(level == "error"){
+        return log_level::ERROR;
+    } else if(level == "none"){
+        return log_level::NONE;
+    }
+
+    return default_level;
+}
+
+bool log_enabled_at_runtime(log_level level){
+    return static_cast<int>(level) >= runtime_level.load(std::memory_order_relaxed);
+}
+
+void start_logger(){
+    stopping = false;
+    logger_thread = std::thread(logger_loop);
+    running = true;
+
+    // The records are not lost when main returns
+    std::atexit(stop_logger);
+}
+
+void stop_logger(){
+    if(!logger_thread.joinable()){
+        return;
+    }
+
+    // The next records are written directly
+    running = false;
+    stopping = true;
+
+    logger_thread.join();
+}
+
+std::size_t get_log_dropped(){
+    return dropped().value.load(std::memory_order_relaxed);
+}
+
+log_line& log_line::write(const char* data, std::size_t n){
+    n = std::min(n, max_log_message - size);
+    std::memcpy(message + size, data, n);
+    size += n;
+    return *this;
+}
+
+log_line::~log_line(){
+    if(!running.load(std::memory_order_relaxed)){
+        // Before the start or after the stop of the logger
+        write_record(level, message, size);
+        std::fflush(level >= log_level::WARNING ? stderr : stdout);
+        return;
+    }
+
+    auto& ring = *local_ring.ring;
+
+    auto head = ring.head.load(std::memory_order_relaxed);
+
+    if(head - ring.tail.load(std::memory_order_acquire) >= ring_capacity){
+        dropped().inc();
+        return;
+    }
+
+    auto& record    = ring.records[head % ring_capacity];
+    record.sequence = sequence.fetch_add(1, std::memory_order_relaxed);
+    record.level    = level;
+    record.size     = size;
+    std::memcpy(record.message, message, size);
+
+    ring.head.store(head + 1, std::memory_order_release);
+}
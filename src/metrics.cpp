@@ -0,0 +1,211 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <iomanip>
+
+#include "metrics.hpp"
+
+const std::uint64_t latency_bounds_us[latency_buckets] = {
+    50, 100, 250, 500,
+    1000, 2500, 5000, 10000,
+    25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 10000000};
+
+namespace {
+
+enum class metric_type {
+    COUNTER,
+    GAUGE,
+    HISTOGRAM
+};
+
+struct metric_series {
+    std::string labels;
+    std::unique_ptr<metric_counter> counter;
+    std::unique_ptr<metric_gauge> gauge;
+    std::unique_ptr<metric_histogram> histogram;
+};
+
+struct metric_family {
+    metric_type type;
+    std::string help;
+    std::vector<metric_series> series;
+};
+
+// The families are sorted by name, the series are never removed
+std::mutex metrics_lock;
+std::map<std::string, metric_family> families;
+
+metric_series& find_series(const std::string& name, const std::string& help, const std::string& labels, metric_type type){
+    auto& family = families[name];
+
+    if(family.series.empty()){
+        family.type = type;
+        family.help = help;
+    }
+
+    for(auto& series : family.series){
+        if(series.labels == labels){
+            return series;
+        }
+    }
+
+    family.series.emplace_back();
+    family.series.back().labels = labels;
+    return family.series.back();
+}
+
+const char* type_name(metric_type type){
+    switch(type){
+        case metric_type::COUNTER:
+            return "counter";
+        case metric_type::GAUGE:
+            return "gauge";
+        case metric_type::HISTOGRAM:
+            return "histogram";
+    }
+
+    return "untyped";
+}
+
+void write_labels(std::ostream& out, const std::string& labels){
+    if(!labels.empty()){
+        out << '{' << labels << '}';
+    }
+}
+
+// Open the labels of a bucket, the caller writes the bound and closes them
+void write_labels(std::ostream& out, const std::string& labels, const char* bucket){
+    out << '{' << labels << (labels.empty() ? "" : ",") << bucket;
+}
+
+// Write a duration in seconds without losing the microseconds
+void write_seconds(std::ostream& out, std::uint64_t duration_us){
+    out << duration_us / 1000000 << '.' << std::setw(6) << std::setfill('0') << duration_us % 1000000 << std::setfill(' ');
+}
+
+void write_histogram(std::ostream& out, const std::string& name, const metric_series& series){
+    std::uint64_t cumulative = 0;
+
+    for(std::size_t i = 0; i <= latency_buckets; ++i){
+        cumulative += series.histogram->buckets[i].load(std::memory_order_relaxed);
+
+        out << name << "_bucket";
+        write_labels(out, series.labels, "le=\"");
+
+        if(i < latency_buckets){
+            write_seconds(out, latency_bounds_us[i]);
+        } else {
+            out << "+Inf";
+        }
+
+        out << "\"} " << cumulative << '\n';
+    }
+
+    out << name << "_sum";
+    write_labels(out, series.labels);
+    out << ' ';
+    write_seconds(out, series.histogram->sum_us.load(std::memory_order_relaxed));
+    out << '\n';
+
+    // The buckets are read one by one, the count must match the +Inf bucket
+    out << name << "_count";
+    write_labels(out, series.labels);
+    out << ' ' << cumulative << '\n';
+}
+
+} //end of anonymous namespace
+
+metric_histogram::metric_histogram(){
+    for(auto& bucket : buckets){
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void metric_histogram::observe(std::uint64_t duration_us){
+    std::size_t i = 0;
+    while(i < latency_buckets && duration_us > latency_bounds_us[i]){
+        ++i;
+    }
+
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    sum_us.fetch_add(duration_us, std::memory_order_relaxed);
+}
+
+metric_counter& get_counter(const std::string& name, const std::string& help, const std::string& labels){
+    std::lock_guard<std::mutex> l(metrics_lock);
+
+    auto& series = find_series(name, help, labels, metric_type::COUNTER);
+    if(!series.counter){
+        series.counter.reset(new metric_counter);
+    }
+
+    return *series.counter;
+}
+
+metric_gauge& get_gauge(const std::string& name, const std::string& help, const std::string& labels){
+    std::lock_guard<std::mutex> l(metrics_lock);
+
+    auto& series = find_series(name, help, labels, metric_type::GAUGE);
+    if(!series.gauge){
+        series.gauge.reset(new metric_gauge);
+    }
+
+    return *series.gauge;
+}
+
+metric_histogram& get_histogram(const std::string& name, const std::string& help, const std::string& labels){
+    std::lock_guard<std::mutex> l(metrics_lock);
+
+    auto& series = find_series(name, help, labels, metric_type::HISTOGRAM);
+    if(!series.histogram){
+        series.histogram.reset(new metric_histogram);
+    }
+
+    return *series.histogram;
+}
+
+void write_metrics(std::ostream& out){
+    std::lock_guard<std::mutex> l(metrics_lock);
+
+    for(auto& entry : families){
+        auto& name   = entry.first;
+        auto& family = entry.second;
+
+        out << "# HELP " << name << ' ' << family.help << '\n';
+        out << "# TYPE " << name << ' ' << type_name(family.type) << '\n';
+
+        for(auto& series : family.series){
+            // A series registered with another type than its family is ignored
+            if(family.type == metric_type::HISTOGRAM && series.histogram){
+                write_histogram(out, name, series);
+            } else if(family.type == metric_type::COUNTER && series.counter){
+                out << name;
+                write_labels(out, series.labels);
+                out << ' ' << series.counter->value.load(std::memory_order_relaxed) << '\n';
+            } else if(family.type == metric_type::GAUGE && series.gauge){
+                out << name;
+                write_labels(out, series.labels);
+                out << ' ' << series.gauge->value.load(std::memory_order_relaxed) << '\n';
+            }
+        }
+    }
+}
+
+void write_metric(std::ostream& out, const char* name, const char* type, const char* help, double value){
+    out << "# HELP " << name << ' ' << help << '\n';
+    out << "# TYPE " << name << ' ' << type << '\n';
+
+    // The counters exceed the default precision long before they wrap
+    auto precision = out.precision(15);
+    out << name << ' ' << value << '\n';
+    out.precision(precision);
+}
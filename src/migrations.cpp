@@ -0,0 +1,176 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <vector>
+#include <chrono>
+
+#include "migrations.hpp"
+
+namespace {
+
+struct migration {
+    std::size_t version;
+    const char* description;
+    void (*apply)(CppSQLite3DB& db);
+    bool transaction; ///< false for the statements that cannot run in a transaction (vacuum)
+};
+
+void add_time_range_indexes(CppSQLite3DB& db){
+    // The history queries filter on the device and a time range, or take the last value
+    db.execDML("create index if not exists sensor_data_fk_time on sensor_data(fk_sensor, time);");
+    db.execDML("create index if not exists actuator_data_fk_time on actuator_data(fk_actuator, time);");
+
+    // The devices are looked up by name (the names of the sources are already unique)
+    db.execDML("create unique index if not exists sensor_name_type on sensor(name, type);");
+    db.execDML("create unique index if not exists actuator_name on actuator(name);");
+    db.execDML("create index if not exists action_source_name on action(fk_source, name);");
+
+    db.execDML("create index if not exists condition_fk_sensor on condition(fk_sensor);");
+    db.execDML("create index if not exists condition_fk_actuator on condition(fk_actuator);");
+}
+
+void add_sensor_value_table(CppSQLite3DB& db){
+    // Values as REAL and times as epoch milliseconds, clustered by sensor and time.
+    // The legacy sensor_data rows are moved online by migrate_sensor_data_batch
+    db.execDML(
+        "create table if not exists sensor_value(fk_sensor integer not null, time integer not null, value real,"
+        "primary key(fk_sensor, time), foreign key(fk_sensor) references sensor(pk_sensor)) without rowid;");
+}
+
+void enable_incremental_vacuum(CppSQLite3DB& db){
+    // The mode of an existing database only changes with a full vacuum
+    db.execDML("pragma auto_vacuum = incremental;");
+    db.execDML("vacuum;");
+}
+
+// There is no transaction to roll back if it failed to begin
+void rollback(CppSQLite3DB& db){
+    try {
+        db.execDML("rollback transaction;");
+    } catch (CppSQLite3Exception& e) {
+        // No transaction is open
+    }
+}
+
+// The migrations, in order, the versions are never reused
+const std::vector<migration> migrations{
+    {1, "indexes for the time range and name lookups", add_time_range_indexes, true},
+    {2, "typed sensor values with epoch-ms times", add_sensor_value_table, true},
+    {3, "incremental vacuum", enable_incremental_vacuum, false},
+};
+
+} //end of anonymous namespace
+
+std::size_t schema_version(CppSQLite3DB& db){
+    CppSQLite3Query query = db.execQuery("select coalesce(max(version), 0) from schema_version;");
+    return query.getInt64Field(0);
+}
+
+bool run_migrations(CppSQLite3DB& db){
+    db.execDML(
+        "create table if not exists schema_version(version integer primary key, description text,"
+        "applied datetime not null default current_timestamp, duration_ms integer);");
+
+    auto current = schema_version(db);
+
+    for(auto& migration : migrations){
+        if(migration.version <= current){
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        try {
+            if(migration.transaction){
+                db.execDML("begin transaction;");
+            }
+
+            migration.apply(db);
+
+            auto end = std::chrono::steady_clock::now();
+            auto ms  = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+            db_exec_dml(db, "insert into schema_version(version, description, duration_ms) values (%d, \"%s\", %d);",
+                        migration.version, migration.description, ms);
+
+            if(migration.transaction){
+                db.execDML("commit transaction;");
+            }
+
+            ASGARD_INFO << "asgard: db: migration " << migration.version << " (" << migration.description << ") applied in " << ms << "ms";
+        } catch (CppSQLite3Exception& e) {
+            ASGARD_ERROR << "asgard: db: migration " << migration.version << " (" << migration.description << ") failed: "
+                         << e.errorCode() << ":" << e.errorMessage();
+
+            if(migration.transaction){
+                rollback(db);
+            }
+
+            return false;
+        }
+
+        current = migration.version;
+    }
+
+    ASGARD_INFO << "asgard: db: schema version " << current;
+
+    return true;
+}
+
+std::size_t migrate_sensor_data_batch(CppSQLite3DB& db, std::size_t batch_size){
+    int last = db_exec_scalar(db, "select coalesce(max(pk_sensor_data), 0) from sensor_data;");
+
+    if(last <= 0){
+        return 0;
+    }
+
+    auto first = last - int(batch_size);
+
+    // The rows are only deleted if they have all been copied
+    try {
+        db.execDML("begin transaction;");
+
+        CppSQLite3Buffer count;
+        count.format("select count(*) from sensor_data where pk_sensor_data > %d;", first);
+        auto selected = db.execScalar(count);
+
+        // The legacy times have a precision of one second, the values of the
+        // same second of a sensor are numbered in pk order to stay distinct and
+        // in order. The batches go down from the most recent rows, the older
+        // rows of a second are still in the table when it is numbered.
+        CppSQLite3Buffer copy;
+        copy.format(
+            "insert or ignore into sensor_value(fk_sensor, time, value) "
+            "select d.fk_sensor, cast(strftime('%%s', d.time) as integer) * 1000 + "
+            "(select count(*) from sensor_data p where p.fk_sensor = d.fk_sensor and p.time = d.time and p.pk_sensor_data < d.pk_sensor_data), "
+            "cast(d.data as real) from sensor_data d where d.pk_sensor_data > %d;", first);
+        auto copied = db.execDML(copy);
+
+        // A value collides with an existing one (or has no valid time), keep the legacy rows
+        if(copied != selected){
+            ASGARD_ERROR << "asgard: db: failed to convert the sensor history: " << (selected - copied)
+                         << " values of the rows after " << first << " cannot be copied, the rows are kept in sensor_data";
+
+            rollback(db);
+            return 0;
+        }
+
+        CppSQLite3Buffer remove;
+        remove.format("delete from sensor_data where pk_sensor_data > %d;", first);
+        auto moved = db.execDML(remove);
+
+        db.execDML("commit transaction;");
+
+        return moved;
+    } catch (CppSQLite3Exception& e) {
+        ASGARD_ERROR << "asgard: db: failed to convert the sensor history: " << e.errorCode() << ":" << e.errorMessage();
+
+        rollback(db);
+    }
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cstring>
+
+#include "protocol.hpp"
+
+namespace {
+
+std::uint64_t read_le(const char* data, std::size_t bytes){
+    std::uint64_t value = 0;
+
+    for(std::size_t i = 0; i < bytes; ++i){
+        value |= std::uint64_t(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+
+    return value;
+}
+
+void write_le(std::string& buffer, std::uint64_t value, std::size_t bytes){
+    for(std::size_t i = 0; i < bytes; ++i){
+        buffer += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+} //end of anonymous namespace
+
+std::size_t declared_frame_size(const char* data, std::size_t size){
+    if(size < frame_header_size){
+        return 0;
+    }
+
+    return frame_header_size + read_le(data, frame_header_size);
+}
+
+std::size_t complete_frame_size(const char* data, std::size_t size){
+    auto frame_size = declared_frame_size(data, size);
+
+    return frame_size && size >= frame_size ? frame_size : 0;
+}
+
+frame_reader::frame_reader(const char* data, std::size_t size) : data(data), size(size) {}
+
+bool frame_reader::read_u8(std::uint8_t& value){
+    if(position + 1 > size){
+        return false;
+    }
+
+    value = static_cast<std::uint8_t>(data[position++]);
+
+    return true;
+}
+
+bool frame_reader::read_u32(std::uint32_t& value){
+    if(position + 4 > size){
+        return false;
+    }
+
+    value = read_le(data + position, 4);
+    position += 4;
+
+    return true;
+}
+
+bool frame_reader::read_f64(double& value){
+    if(position + 8 > size){
+        return false;
+    }
+
+    auto bits = read_le(data + position, 8);
+    std::memcpy(&value, &bits, sizeof(value));
+    position += 8;
+
+    return true;
+}
+
+bool frame_reader::read_string(std::string& value){
+    if(position + 2 > size){
+        return false;
+    }
+
+    auto length = read_le(data + position, 2);
+
+    if(position + 2 + length > size){
+        return false;
+    }
+
+    value.assign(data + position + 2, length);
+    position += 2 + length;
+
+    return true;
+}
+
+const char* binary_command_name(std::uint8_t command){
+    switch (static_cast<binary_command>(command)) {
+        case binary_command::UNREG_SOURCE:
+            return "UNREG_SOURCE";
+        case binary_command::REG_SENSOR:
+            return "REG_SENSOR";
+        case binary_command::UNREG_SENSOR:
+            return "UNREG_SENSOR";
+        case binary_command::REG_ACTUATOR:
+            return "REG_ACTUATOR";
+        case binary_command::UNREG_ACTUATOR:
+            return "UNREG_ACTUATOR";
+        case binary_command::REG_ACTION:
+            return "REG_ACTION";
+        case binary_command::UNREG_ACTION:
+            return "UNREG_ACTION";
+        case binary_command::DATA:
+            return "DATA";
+        case binary_command::EVENT:
+            return "EVENT";
+        case binary_command::ACTION:
+            return "ACTION";
+        case binary_command::ID:
+            return "ID";
+    }
+
+    return "UNKNOWN";
+}
+
+frame_writer::frame_writer(binary_command command){
+    // The size is completed in frame()
+    buffer.assign(frame_header_size, '\0');
+    buffer += static_cast<char>(command);
+}
+
+void frame_writer::write_u32(std::uint32_t value){
+    write_le(buffer, value, 4);
+}
+
+void frame_writer::write_f64(double value){
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(value));
+    write_le(buffer, bits, 8);
+}
+
+void frame_writer::write_string(const std::string& value){
+    write_le(buffer, value.size(), 2);
+    buffer += value;
+}
+
+const std::string& frame_writer::frame(){
+    auto size = buffer.size() - frame_header_size;
+
+    buffer[0] = static_cast<char>(size & 0xFF);
+    buffer[1] = static_cast<char>((size >> 8) & 0xFF);
+
+    return buffer;
+}
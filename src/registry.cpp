@@ -0,0 +1,181 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "registry.hpp"
+
+namespace {
+
+template<typename T>
+std::shared_ptr<T> find(const std::unordered_map<std::size_t, std::shared_ptr<T>>& map, std::size_t id){
+    auto it = map.find(id);
+    return it == map.end() ? nullptr : it->second;
+}
+
+} //end of anonymous namespace
+
+std::shared_ptr<source_t> device_registry::add_source(const std::string& name, int socket){
+    auto source = std::make_shared<source_t>();
+
+    source->name              = name;
+    source->id_sql            = 0;
+    source->sensors_counter   = 0;
+    source->actuators_counter = 0;
+    source->actions_counter   = 0;
+    source->socket            = socket;
+
+    std::lock_guard<std::mutex> l(lock);
+
+    source->id = current_source++;
+    by_id[source->id] = source;
+
+    return source;
+}
+
+void device_registry::set_source_sql(source_t& source, std::size_t id_sql){
+    std::lock_guard<std::mutex> l(lock);
+
+    source.id_sql = id_sql;
+
+    auto it = by_id.find(source.id);
+    if(it != by_id.end()){
+        by_sql[id_sql] = it->second;
+    }
+}
+
+bool device_registry::remove_source(std::size_t source_id){
+    std::lock_guard<std::mutex> l(lock);
+
+    auto it = by_id.find(source_id);
+
+    if(it == by_id.end()){
+        return false;
+    }
+
+    // Only remove the SQL index if it was not taken over by a new registration
+    auto sql = by_sql.find(it->second->id_sql);
+    if(sql != by_sql.end() && sql->second == it->second){
+        by_sql.erase(sql);
+    }
+
+    by_id.erase(it);
+
+    return true;
+}
+
+std::vector<std::size_t> device_registry::remove_sources(int socket){
+    std::lock_guard<std::mutex> l(lock);
+
+    std::vector<std::size_t> removed;
+
+    for(auto it = by_id.begin(); it != by_id.end();){
+        if(it->second->socket != socket){
+            ++it;
+            continue;
+        }
+
+        auto sql = by_sql.find(it->second->id_sql);
+        if(sql != by_sql.end() && sql->second == it->second){
+            by_sql.erase(sql);
+        }
+
+        removed.push_back(it->first);
+        it = by_id.erase(it);
+    }
+
+    return removed;
+}
+
+std::shared_ptr<source_t> device_registry::source(std::size_t source_id) const {
+    std::lock_guard<std::mutex> l(lock);
+    return find(by_id, source_id);
+}
+
+std::shared_ptr<source_t> device_registry::source_from_sql(std::size_t id_sql) const {
+    std::lock_guard<std::mutex> l(lock);
+    return find(by_sql, id_sql);
+}
+
+std::shared_ptr<sensor_t> device_registry::add_sensor(source_t& source){
+    auto sensor = std::make_shared<sensor_t>();
+
+    sensor->id_sql     = 0;
+    sensor->last_event = std::chrono::milliseconds::zero();
+    sensor->first      = true;
+    sensor->last_value = 0.0;
+
+    std::lock_guard<std::mutex> l(lock);
+
+    sensor->id = source.sensors_counter++;
+    source.sensors[sensor->id] = sensor;
+
+    return sensor;
+}
+
+std::shared_ptr<actuator_t> device_registry::add_actuator(source_t& source){
+    auto actuator = std::make_shared<actuator_t>();
+
+    actuator->id_sql     = 0;
+    actuator->last_event = std::chrono::milliseconds::zero();
+
+    std::lock_guard<std::mutex> l(lock);
+
+    actuator->id = source.actuators_counter++;
+    source.actuators[actuator->id] = actuator;
+
+    return actuator;
+}
+
+std::shared_ptr<action_t> device_registry::add_action(source_t& source){
+    auto action = std::make_shared<action_t>();
+
+    std::lock_guard<std::mutex> l(lock);
+
+    action->id = source.actions_counter++;
+    source.actions[action->id] = action;
+
+    return action;
+}
+
+bool device_registry::remove_sensor(std::size_t source_id, std::size_t sensor_id){
+    std::lock_guard<std::mutex> l(lock);
+
+    auto source = find(by_id, source_id);
+    return source && source->sensors.erase(sensor_id);
+}
+
+bool device_registry::remove_actuator(std::size_t source_id, std::size_t actuator_id){
+    std::lock_guard<std::mutex> l(lock);
+
+    auto source = find(by_id, source_id);
+    return source && source->actuators.erase(actuator_id);
+}
+
+bool device_registry::remove_action(std::size_t source_id, std::size_t action_id){
+    std::lock_guard<std::mutex> l(lock);
+
+    auto source = find(by_id, source_id);
+    return source && source->actions.erase(action_id);
+}
+
+std::shared_ptr<sensor_t> device_registry::sensor(std::size_t source_id, std::size_t sensor_id) const {
+    std::lock_guard<std::mutex> l(lock);
+
+    auto source = find(by_id, source_id);
+    return source ? find(source->sensors, sensor_id) : nullptr;
+}
+
+std::shared_ptr<actuator_t> device_registry::actuator(std::size_t source_id, std::size_t actuator_id) const {
+    std::lock_guard<std::mutex> l(lock);
+
+    auto source = find(by_id, source_id);
+    return source ? find(source->actuators, actuator_id) : nullptr;
+}
+
+std::size_t device_registry::sources() const {
+    std::lock_guard<std::mutex> l(lock);
+    return by_id.size();
+}
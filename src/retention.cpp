@@ -0,0 +1,200 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+
+#include <ctime>
+#include <cstdint>
+
+#include "retention.hpp"
+#include "rollup.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+enum class prune_kind {
+    SENSOR,
+    ROLLUP,
+    ACTUATOR
+};
+
+struct prune_task {
+    prune_kind kind;
+    std::size_t fk;
+    std::size_t resolution; ///< Only for the rollups
+    std::time_t cutoff;     ///< Everything older is deleted
+};
+
+retention_config config{};
+
+// The pass is only accessed by the writer thread
+std::deque<prune_task> tasks;
+clock_type::time_point next_pass;
+std::size_t pass_ms = 0;
+
+std::mutex stats_lock;
+retention_stats stats{};
+
+// Same format as SQLite current_timestamp (UTC)
+std::string format_time(std::time_t time){
+    std::tm tm;
+    gmtime_r(&time, &tm);
+
+    char buffer[32];
+    auto n = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+
+    return {buffer, n};
+}
+
+std::size_t raw_days(const std::string& type){
+    auto it = config.raw_days_by_type.find(type);
+    return it == config.raw_days_by_type.end() ? config.raw_days : it->second;
+}
+
+void start_pass(CppSQLite3DB& db){
+    auto now = std::time(nullptr);
+
+    for(auto& data : db_exec_query(db, "select pk_sensor, type from sensor;")){
+        std::size_t sensor_pk = data.getIntField(0);
+
+        if(auto days = raw_days(data.fieldValue(1))){
+            tasks.push_back({prune_kind::SENSOR, sensor_pk, 0, now - std::time_t(days) * 86400});
+        }
+
+        if(config.rollup_days){
+            for(auto resolution : rollup_resolutions){
+                tasks.push_back({prune_kind::ROLLUP, sensor_pk, resolution, now - std::time_t(config.rollup_days) * 86400});
+            }
+        }
+    }
+
+    if(config.actuator_days){
+        for(auto& data : db_exec_query(db, "select pk_actuator from actuator;")){
+            tasks.push_back({prune_kind::ACTUATOR, std::size_t(data.getIntField(0)), 0, now - std::time_t(config.actuator_days) * 86400});
+        }
+    }
+
+    pass_ms = 0;
+}
+
+// Delete at most batch_size rows of the task
+std::size_t prune(CppSQLite3DB& db, const prune_task& task){
+    auto batch = config.batch_size;
+
+    switch(task.kind){
+        case prune_kind::SENSOR: {
+            // The times are unique for a sensor, everything before the (batch+1)-th oldest value
+            std::int64_t cutoff = std::int64_t(task.cutoff) * 1000;
+
+            return db_exec_dml(db,
+                "delete from sensor_value where fk_sensor=%d and time < coalesce("
+                "(select time from sensor_value where fk_sensor=%d and time < %d order by time limit 1 offset %d), %d);",
+                task.fk, task.fk, cutoff, batch, cutoff);
+        }
+
+        case prune_kind::ROLLUP:
+            return db_exec_dml(db,
+                "delete from sensor_rollup where fk_sensor=%d and resolution=%d and bucket < coalesce("
+                "(select bucket from sensor_rollup where fk_sensor=%d and resolution=%d and bucket < %d order by bucket limit 1 offset %d), %d);",
+                task.fk, task.resolution, task.fk, task.resolution, task.cutoff, batch, task.cutoff);
+
+        case prune_kind::ACTUATOR:
+            return db_exec_dml(db,
+                "delete from actuator_data where pk_actuator_data in "
+                "(select pk_actuator_data from actuator_data where fk_actuator=%d and time < \"%s\" order by time limit %d);",
+                task.fk, format_time(task.cutoff).c_str(), batch);
+    }
+
+    return 0;
+}
+
+// Give the free pages back to the file system, a few at a time
+std::size_t vacuum(CppSQLite3DB& db){
+    if(!config.vacuum_pages){
+        return 0;
+    }
+
+    auto page_size = db.execScalar("pragma page_size;");
+    auto before    = db.execScalar("pragma page_count;");
+
+    CppSQLite3Buffer buffSQL;
+    buffSQL.format("pragma incremental_vacuum(%d);", int(config.vacuum_pages));
+    db.execDML(buffSQL);
+
+    auto after = db.execScalar("pragma page_count;");
+
+    return before > after ? std::size_t(before - after) * page_size : 0;
+}
+
+} //end of anonymous namespace
+
+void configure_retention(const retention_config& new_config){
+    config    = new_config;
+    next_pass = clock_type::now();
+}
+
+bool prune_step(CppSQLite3DB& db){
+    if(tasks.empty()){
+        if(!config.interval_s || clock_type::now() < next_pass){
+            return false;
+        }
+
+        next_pass = clock_type::now() + std::chrono::seconds(config.interval_s);
+
+        start_pass(db);
+
+        if(tasks.empty()){
+            return false;
+        }
+    }
+
+    auto start = clock_type::now();
+
+    std::size_t deleted   = 0;
+    std::size_t reclaimed = 0;
+
+    try {
+        deleted = prune(db, tasks.front());
+
+        // A partial batch means the task is done
+        if(deleted < config.batch_size){
+            tasks.pop_front();
+        }
+
+        reclaimed = vacuum(db);
+    } catch (CppSQLite3Exception& e) {
+        ASGARD_ERROR << "asgard: db: pruning failed: " << e.errorCode() << ":" << e.errorMessage();
+        tasks.pop_front();
+    }
+
+    auto end = clock_type::now();
+    std::size_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    pass_ms += ms;
+
+    std::lock_guard<std::mutex> l(stats_lock);
+
+    stats.deleted_rows += deleted;
+    stats.reclaimed_bytes += reclaimed;
+    stats.max_step_ms = std::max(stats.max_step_ms, ms);
+
+    if(tasks.empty()){
+        ++stats.passes;
+        stats.last_pass_ms = pass_ms;
+    }
+
+    return !tasks.empty();
+}
+
+retention_stats get_retention_stats(){
+    std::lock_guard<std::mutex> l(stats_lock);
+    return stats;
+}
@@ -0,0 +1,71 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "rollup.hpp"
+
+const std::vector<std::size_t> rollup_resolutions{60, 3600, 86400};
+
+namespace {
+
+const std::size_t hourly_rollup_after = 48 * 3600;
+
+} //end of anonymous namespace
+
+void create_rollup_tables(CppSQLite3DB& db){
+    bool exists = db.tableExists("sensor_rollup");
+
+    db.execDML(
+        "create table if not exists sensor_rollup(fk_sensor integer, resolution integer, bucket integer,"
+        "min real, max real, sum real, count integer, primary key(fk_sensor, resolution, bucket),"
+        "foreign key(fk_sensor) references sensor(pk_sensor));");
+
+    if(!exists){
+        // Build the rollups of the existing history
+
+        ASGARD_INFO << "asgard: db: Build the sensor rollups from the history";
+
+        for(auto resolution : rollup_resolutions){
+            CppSQLite3Buffer buffSQL;
+            buffSQL.format(
+                "insert into sensor_rollup(fk_sensor, resolution, bucket, min, max, sum, count) "
+                "select fk_sensor, %d, cast(strftime('%%s', time) as integer) / %d * %d as bucket, "
+                "min(cast(data as real)), max(cast(data as real)), sum(cast(data as real)), count(*) "
+                "from sensor_data group by fk_sensor, bucket;",
+                int(resolution), int(resolution), int(resolution));
+            db.execDML(buffSQL);
+        }
+    }
+}
+
+void update_rollups(CppSQLite3DB& db, std::size_t fk_sensor, std::time_t time, double value){
+    for(auto resolution : rollup_resolutions){
+        auto bucket = time / resolution * resolution;
+
+        db_exec_dml(db, "insert or ignore into sensor_rollup(fk_sensor, resolution, bucket, min, max, sum, count) values (%d, %d, %d, %f, %f, 0, 0);",
+                    fk_sensor, resolution, bucket, value, value);
+        db_exec_dml(db, "update sensor_rollup set min = min(min, %f), max = max(max, %f), sum = sum + %f, count = count + 1 "
+                        "where fk_sensor = %d and resolution = %d and bucket = %d;",
+                    value, value, value, fk_sensor, resolution, bucket);
+    }
+}
+
+std::size_t select_rollup_resolution(std::size_t seconds, std::size_t points){
+    std::size_t selected = 0;
+
+    for(auto resolution : rollup_resolutions){
+        if(seconds / resolution >= points){
+            selected = resolution;
+        }
+    }
+
+    // Beyond two days, the minute rollup gives thousands of points per chart
+    if(seconds > hourly_rollup_after && selected < 3600){
+        selected = 3600;
+    }
+
+    return selected;
+}
@@ -0,0 +1,233 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "db.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "rules.hpp"
+#include "scheduler.hpp"
+#include "server.hpp"
+
+namespace {
+
+const std::vector<compiled_rule> no_rules;
+
+std::shared_ptr<const rule_index> current_rules = std::make_shared<rule_index>();
+
+bool compare(rule_operator op, double lhs, double rhs){
+    switch(op){
+        case rule_operator::EQUALS:
+            return lhs == rhs;
+        case rule_operator::NOT_EQUALS:
+            return lhs != rhs;
+        case rule_operator::GREATER:
+            return lhs > rhs;
+        case rule_operator::GREATER_EQUALS:
+            return lhs >= rhs;
+        case rule_operator::LESS:
+            return lhs < rhs;
+        case rule_operator::LESS_EQUALS:
+            return lhs <= rhs;
+    }
+
+    return false;
+}
+
+} //end of anonymous namespace
+
+const std::vector<compiled_rule>& rule_index::sensor(std::size_t fk_sensor) const {
+    auto it = sensor_rules.find(fk_sensor);
+    return it == sensor_rules.end() ? no_rules : it->second;
+}
+
+const std::vector<compiled_rule>& rule_index::actuator(std::size_t fk_actuator) const {
+    auto it = actuator_rules.find(fk_actuator);
+    return it == actuator_rules.end() ? no_rules : it->second;
+}
+
+const compiled_rule* rule_index::find(std::size_t pk_rule) const {
+    auto it = rules.find(pk_rule);
+    return it == rules.end() ? nullptr : it->second;
+}
+
+bool parse_rule_operator(const std::string& op, rule_operator& result, bool& once){
+    static const std::string once_suffix = " (once)";
+
+    auto base = op;
+    once      = false;
+
+    if(op.size() > once_suffix.size() && op.compare(op.size() - once_suffix.size(), once_suffix.size(), once_suffix) == 0){
+        base = op.substr(0, op.size() - once_suffix.size());
+        once = true;
+    }
+
+    if(base == "=="){
+        result = rule_operator::EQUALS;
+    } else if(base == "!="){
+        result = rule_operator::NOT_EQUALS;
+    } else if(base == ">"){
+        result = rule_operator::GREATER;
+    } else if(base == ">="){
+        result = rule_operator::GREATER_EQUALS;
+    } else if(base == "<"){
+        result = rule_operator::LESS;
+    } else if(base == "<="){
+        result = rule_operator::LESS_EQUALS;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool rule_matches(const compiled_rule& rule, double value, double last_value, bool first){
+    if(!compare(rule.op, value, rule.threshold)){
+        return false;
+    }
+
+    return !rule.once || first || !compare(rule.op, last_value, rule.threshold);
+}
+
+void execute_rule(const compiled_rule& rule){
+    ASGARD_INFO << "asgard: Execute rule " << rule.pk_rule;
+
+    static auto& fires = get_counter("asgard_rule_fires_total", "Number of rules executed");
+    fires.inc();
+
+    if(rule.fk_action){
+        // Get the action from the database
+
+        CppSQLite3Query action_query = db_exec_query(get_db(), "select fk_source, type, name from action where pk_action = %d;", rule.fk_action);
+
+        if(action_query.eof()){
+            ASGARD_ERROR << "asgard: Invalid link in database pk_condition <> fk_condition";
+            return;
+        }
+
+        auto fk_source          = action_query.getIntField(0);
+        std::string action_type = action_query.fieldValue(1);
+        std::string action_name = action_query.fieldValue(2);
+
+        // Make sure the driver is active
+
+        if(!source_sql_exists(fk_source)){
+            ASGARD_ERROR << "asgard: The source for the action is not active";
+            return;
+        }
+
+        // Get the client address from the SQL id
+
+        auto client_addr = source_addr_from_sql(fk_source);
+
+        // Execute the action
+
+        if(action_type == "SIMPLE"){
+            send_to_driver(client_addr, "ACTION " + action_name);
+        } else {
+            send_to_driver(client_addr, "ACTION " + action_name + " " + rule.value);
+        }
+    }
+}
+
+void run_rules(const std::vector<std::size_t>& sequence){
+    auto index = get_rules();
+
+    for(std::size_t i = 0; i < sequence.size(); ++i){
+        auto rule = index->find(sequence[i]);
+
+        if(!rule){
+            ASGARD_ERROR << "asgard: The rule " << sequence[i] << " does not exist anymore";
+            continue;
+        }
+
+        if(!rule->fk_action && rule->system_action == 1){
+            // Sleep: the rest of the sequence becomes a timer continuation
+            std::vector<std::size_t> rest(sequence.begin() + i + 1, sequence.end());
+
+            if(!rest.empty()){
+                auto delay = std::atoi(rule->value.c_str());
+                auto id    = schedule_rules(std::max(delay, 0), rest);
+
+                ASGARD_INFO << "asgard: Delay " << rest.size() << " rules by " << delay << "s (timer " << id << ")";
+            }
+
+            return;
+        }
+
+        execute_rule(*rule);
+    }
+}
+
+void reload_rules(){
+    auto index = std::make_shared<rule_index>();
+
+    std::size_t loaded = 0;
+
+    auto query = db_exec_query(get_db(),
+        "select rule.pk_rule, rule.fk_action, rule.system_action, rule.value, condition.pk_condition, "
+        "condition.value, condition.operator, condition.fk_sensor, condition.fk_actuator "
+        "from rule left join condition on condition.pk_condition = rule.fk_condition;");
+
+    for(auto& data : query){
+        if(data.fieldIsNull(4)){
+            ASGARD_ERROR << "asgard: Invalid link in database pk_condition <> fk_condition";
+            continue;
+        }
+
+        compiled_rule rule;
+        rule.pk_rule       = data.getIntField(0);
+        rule.fk_action     = data.getIntField(1);
+        rule.system_action = data.getIntField(2);
+        rule.value         = data.fieldValue(3);
+        rule.threshold     = std::atof(data.fieldValue(5));
+        rule.op            = rule_operator::EQUALS;
+        rule.once          = false;
+
+        std::string op  = data.fieldValue(6);
+        auto fk_sensor   = data.getIntField(7);
+        auto fk_actuator = data.getIntField(8);
+
+        if(fk_sensor && !fk_actuator){
+            if(!parse_rule_operator(op, rule.op, rule.once)){
+                ASGARD_ERROR << "asgard: Invalid condition operator " << op;
+                continue;
+            }
+
+            index->sensor_rules[fk_sensor].push_back(rule);
+        } else if(fk_actuator && !fk_sensor){
+            index->actuator_rules[fk_actuator].push_back(rule);
+        } else {
+            continue;
+        }
+
+        ++loaded;
+    }
+
+    // The index is complete, the rules will not move anymore
+    for(auto& device_rules : index->sensor_rules){
+        for(auto& rule : device_rules.second){
+            index->rules[rule.pk_rule] = &rule;
+        }
+    }
+
+    for(auto& device_rules : index->actuator_rules){
+        for(auto& rule : device_rules.second){
+            index->rules[rule.pk_rule] = &rule;
+        }
+    }
+
+    std::atomic_store(&current_rules, std::shared_ptr<const rule_index>(index));
+
+    ASGARD_INFO << "asgard:rules: Compiled " << loaded << " rules";
+}
+
+std::shared_ptr<const rule_index> get_rules(){
+    return std::atomic_load(&current_rules);
+}
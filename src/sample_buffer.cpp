@@ -0,0 +1,82 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <algorithm>
+
+#include "sample_buffer.hpp"
+
+constexpr std::size_t sample_buffer::capacity;
+
+void sample_buffer::push(std::time_t time, double value, const char* raw, std::size_t size){
+    std::lock_guard<std::mutex> l(lock);
+
+    times[head]  = time;
+    values[head] = value;
+
+    head = (head + 1) % capacity;
+
+    if(count < capacity){
+        ++count;
+    }
+
+    // Reuses the storage of the previous value
+    last_raw.assign(raw, size);
+}
+
+bool sample_buffer::empty() const {
+    std::lock_guard<std::mutex> l(lock);
+    return count == 0;
+}
+
+bool sample_buffer::latest(std::string& raw) const {
+    std::lock_guard<std::mutex> l(lock);
+
+    if(!count){
+        return false;
+    }
+
+    raw = last_raw;
+
+    return true;
+}
+
+bool sample_buffer::covers(std::time_t from) const {
+    std::lock_guard<std::mutex> l(lock);
+
+    // As long as the buffer is not full, it holds the complete history
+    if(count < capacity){
+        return true;
+    }
+
+    return times[head] <= from;
+}
+
+std::size_t sample_buffer::copy_since(std::time_t from, std::vector<std::time_t>& out_times, std::vector<double>& out_values) const {
+    std::lock_guard<std::mutex> l(lock);
+
+    auto first = (head + capacity - count) % capacity;
+
+    // Skip the samples that are too old
+    std::size_t skip = 0;
+    while(skip < count && times[(first + skip) % capacity] <= from){
+        ++skip;
+    }
+
+    auto n     = count - skip;
+    auto begin = (first + skip) % capacity;
+
+    // At most two contiguous ranges
+    auto tail = std::min(n, capacity - begin);
+
+    out_times.insert(out_times.end(), times.begin() + begin, times.begin() + begin + tail);
+    out_values.insert(out_values.end(), values.begin() + begin, values.begin() + begin + tail);
+
+    out_times.insert(out_times.end(), times.begin(), times.begin() + (n - tail));
+    out_values.insert(out_values.end(), values.begin(), values.begin() + (n - tail));
+
+    return n;
+}
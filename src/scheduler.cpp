@@ -0,0 +1,213 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+
+#include "db.hpp"
+#include "rules.hpp"
+#include "executor.hpp"
+#include "scheduler.hpp"
+#include "timer_wheel.hpp"
+
+namespace {
+
+std::mutex lock;
+std::condition_variable stop_ready;
+bool stopping = false;
+
+timer_wheel wheel(std::time(nullptr));
+std::map<std::size_t, delayed_rules> pending;
+std::size_t next_id = 1;
+
+std::thread scheduler_thread;
+
+std::string serialize(const std::vector<std::size_t>& rules){
+    std::string result;
+
+    for(auto rule : rules){
+        if(!result.empty()){
+            result += ' ';
+        }
+
+        result += std::to_string(rule);
+    }
+
+    return result;
+}
+
+std::vector<std::size_t> deserialize(const std::string& value){
+    std::vector<std::size_t> rules;
+
+    std::stringstream value_ss(value);
+
+    std::size_t rule;
+    while(value_ss >> rule){
+        rules.push_back(rule);
+    }
+
+    return rules;
+}
+
+void scheduler_loop(){
+    std::vector<std::uint64_t> expired;
+    std::vector<delayed_rules> ready;
+    std::vector<bool> submitted;
+
+    std::unique_lock<std::mutex> l(lock);
+
+    while(!stopping){
+        auto next = std::chrono::system_clock::now() + std::chrono::seconds(1);
+
+        stop_ready.wait_until(l, next, []{ return stopping; });
+
+        expired.clear();
+        wheel.advance(std::time(nullptr), expired);
+
+        ready.clear();
+
+        for(auto id : expired){
+            auto it = pending.find(id);
+
+            // Cancelled timers are simply not in the map anymore
+            if(it == pending.end()){
+                continue;
+            }
+
+            ready.push_back(std::move(it->second));
+            pending.erase(it);
+        }
+
+        if(ready.empty()){
+            continue;
+        }
+
+        // The executor can wait for room and the rules it runs take the lock
+        // to schedule their own delays, the tasks are submitted without it
+        l.unlock();
+
+        submitted.assign(ready.size(), false);
+
+        for(std::size_t i = 0; i < ready.size(); ++i){
+            auto& rules = ready[i].rules;
+            submitted[i] = execute_task(ready[i].id, [rules](){ run_rules(rules); });
+        }
+
+        l.lock();
+
+        auto now = std::time(nullptr);
+
+        for(std::size_t i = 0; i < ready.size(); ++i){
+            auto& delayed = ready[i];
+
+            if(submitted[i]){
+                db_exec_dml(get_db(), "delete from delayed_rule where pk_delayed_rule=%d;", delayed.id);
+                continue;
+            }
+
+            // The row is kept and the continuation retried at the next tick
+            ASGARD_WARNING << "asgard: scheduler: the executor refused the delayed rules " << delayed.id << ", retrying";
+
+            delayed.due = now + 1;
+            wheel.add(delayed.id, delayed.due);
+
+            auto id = delayed.id;
+            pending[id] = std::move(delayed);
+        }
+    }
+}
+
+} //end of anonymous namespace
+
+void create_scheduler_tables(CppSQLite3DB& db){
+    db.execDML("create table if not exists delayed_rule(pk_delayed_rule integer primary key, due integer, rules text);");
+}
+
+void start_scheduler(){
+    std::lock_guard<std::mutex> l(lock);
+
+    // Restore the continuations that were pending before the restart
+    for(auto& data : get_db().execQuery("select pk_delayed_rule, due, rules from delayed_rule;")){
+        delayed_rules delayed;
+        delayed.id    = data.getIntField(0);
+        delayed.due   = data.getIntField(1);
+        delayed.rules = deserialize(data.fieldValue(2));
+
+        wheel.add(delayed.id, delayed.due);
+
+        next_id = std::max(next_id, delayed.id + 1);
+        pending[delayed.id] = std::move(delayed);
+    }
+
+    if(!pending.empty()){
+        ASGARD_INFO << "asgard: scheduler: restored " << pending.size() << " delayed rules";
+    }
+
+    scheduler_thread = std::thread(scheduler_loop);
+}
+
+void stop_scheduler(){
+    if(!scheduler_thread.joinable()){
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+
+    stop_ready.notify_one();
+    scheduler_thread.join();
+}
+
+std::size_t schedule_rules(std::size_t delay_s, const std::vector<std::size_t>& rules){
+    std::lock_guard<std::mutex> l(lock);
+
+    delayed_rules delayed;
+    delayed.id    = next_id++;
+    delayed.due   = std::time(nullptr) + delay_s;
+    delayed.rules = rules;
+
+    db_exec_dml(get_db(), "insert into delayed_rule(pk_delayed_rule, due, rules) values (%d, %d, \"%s\");",
+                delayed.id, delayed.due, serialize(rules).c_str());
+
+    wheel.add(delayed.id, delayed.due);
+
+    auto id = delayed.id;
+    pending[id] = std::move(delayed);
+
+    return id;
+}
+
+bool cancel_delayed_rules(std::size_t id){
+    std::lock_guard<std::mutex> l(lock);
+
+    if(!pending.erase(id)){
+        return false;
+    }
+
+    db_exec_dml(get_db(), "delete from delayed_rule where pk_delayed_rule=%d;", id);
+
+    return true;
+}
+
+std::vector<delayed_rules> list_delayed_rules(){
+    std::lock_guard<std::mutex> l(lock);
+
+    std::vector<delayed_rules> result;
+
+    for(auto& delayed : pending){
+        result.push_back(delayed.second);
+    }
+
+    return result;
+}
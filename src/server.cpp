@@ -12,16 +12,23 @@
 #include <vector>
 #include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
 
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
 
 #include <ctime>
@@ -31,10 +38,24 @@
 
 #include "asgard/config.hpp"
 #include "asgard/utils.hpp"
-#include "asgard/network.hpp"
 
+#include "capture.hpp"
 #include "db.hpp"
+#include "db_writer.hpp"
+#include "command_parser.hpp"
+#include "event_stream.hpp"
+#include "executor.hpp"
+#include "fragment_cache.hpp"
+#include "io_buffer.hpp"
+#include "scheduler.hpp"
 #include "led.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "protocol.hpp"
+#include "registry.hpp"
+#include "retention.hpp"
+#include "rules.hpp"
+#include "sample_buffer.hpp"
 #include "display_controller.hpp"
 #include "server.hpp"
 
@@ -45,82 +66,94 @@ std::vector<asgard::KeyValue> config;
 const std::size_t UNIX_PATH_MAX = 108;
 const std::size_t socket_buffer_size = 4096;
 const std::size_t max_sources = 32;
+const std::size_t max_events = 32;
+
+// Defaults for the driver socket, can be overridden in the configuration
+const int default_listen_backlog = 64;
+const int default_max_connections = 64;
+
+// Defaults for the database writer
+const int default_db_batch_size = 256;
+const int default_db_batch_ms   = 500;
+const int default_db_max_queue  = 16384;
+
+// Defaults for the retention of the data (in days, 0 keeps forever). Nothing
+// is deleted unless the retention is enabled in the configuration
+const int default_retention_raw_days      = 0;
+const int default_retention_rollup_days   = 0;
+const int default_retention_actuator_days = 0;
+const int default_retention_interval_s    = 3600;
+const int default_retention_batch_size    = 500;
+const int default_retention_vacuum_pages  = 64;
+
+// Defaults for the rules executor
+const int default_executor_threads  = 2;
+const int default_executor_shards   = 16;
+const int default_executor_capacity = 256;
+
+// Defaults for the live updates of the web clients. A waiting client holds
+// a thread of the web server, most of them must stay free for the pages
+const int default_events_hold_ms     = 15000;
+const int default_events_max_waiting = 2;
+const int limit_events_max_waiting   = 4;
 
 int socket_desc;
-struct sockaddr_in server, client;
-std::vector<std::thread> threads;
+int epoll_fd = -1;
 
-// Allocate space for the buffers
-char receive_buffer[socket_buffer_size];
-char write_buffer[socket_buffer_size];
+// The signals only write to this pipe, the event loop stops when it is readable
+int stop_pipe[2] = {-1, -1};
+struct sockaddr_in server, client;
 
-struct sensor_t {
-    std::size_t id;
-    std::string type;
-    std::string name;
+// Number of driver connections currently owned by the event loop
+int active_connections = 0;
 
-    std::size_t id_sql;
-    std::chrono::milliseconds last_event;
+metric_gauge& connections_gauge(){
+    static auto& connections = get_gauge("asgard_driver_connections", "Number of open driver connections");
+    return connections;
+}
 
-    bool first;
-    std::string last_data;
-};
+// The live sources and devices
+device_registry registry;
 
-struct action_t {
-    std::size_t id;
-    std::string type;
-    std::string name;
-};
+using history_map = std::unordered_map<std::size_t, std::shared_ptr<sample_buffer>>;
 
-struct actuator_t {
-    std::size_t id;
-    std::string name;
+// Recent samples of the devices, by SQL id, kept across reconnections
+std::mutex histories_lock;
+history_map sensor_histories;
+history_map actuator_histories;
 
-    std::size_t id_sql;
-    std::chrono::milliseconds last_event;
-};
+std::shared_ptr<sample_buffer> find_history(history_map& histories, std::size_t id_sql){
+    std::lock_guard<std::mutex> l(histories_lock);
 
-struct source_t {
-    std::size_t id;
-    std::string name;
-    std::vector<sensor_t> sensors;
-    std::vector<actuator_t> actuators;
-    std::vector<action_t> actions;
+    auto it = histories.find(id_sql);
+    return it == histories.end() ? nullptr : it->second;
+}
 
-    std::size_t id_sql;
-    std::size_t sensors_counter;
-    std::size_t actuators_counter;
-    std::size_t actions_counter;
+// The query returns (epoch, value), the most recent first
+template<typename... T>
+std::shared_ptr<sample_buffer> load_history(history_map& histories, std::size_t id_sql, const std::string& query, T... args){
+    auto history = find_history(histories, id_sql);
 
-    int socket;
-};
+    if(history){
+        return history;
+    }
 
-std::size_t current_source = 0;
+    // Warm the buffer with the most recent samples of the database
 
-std::vector<source_t> sources;
+    std::vector<std::pair<std::time_t, std::string>> recent;
 
-source_t& select_source(std::size_t source_id) {
-    for (auto& source : sources) {
-        if (source.id == source_id) {
-            return source;
-        }
+    for(auto& data : db_exec_query(get_db(), query, args...)){
+        recent.emplace_back(data.getIntField(0), data.fieldValue(1));
     }
 
-    std::cerr << "asgard: server: Invalid request for source id " << source_id << std::endl;
+    history = std::make_shared<sample_buffer>();
 
-    return sources.front();
-}
-
-source_t& select_source_from_sql(std::size_t source_id) {
-    for (auto& source : sources) {
-        if (source.id_sql == source_id) {
-            return source;
-        }
+    for(auto it = recent.rbegin(); it != recent.rend(); ++it){
+        history->push(it->first, std::atof(it->second.c_str()), it->second.c_str(), it->second.size());
     }
 
-    std::cerr << "asgard: server: Invalid request for source id sql " << source_id << std::endl;
-
-    return sources.front();
+    std::lock_guard<std::mutex> l(histories_lock);
+    return histories.emplace(id_sql, history).first->second;
 }
 
 // Create the controller handling the requests
@@ -129,513 +162,1016 @@ display_controller controller;
 void cleanup() {
     set_led_off();
     close(socket_desc);
+
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
     unlink("/tmp/asgard_socket");
 }
 
-struct condition {
-    size_t pk_condition;
-    std::string value;
-    std::string op;
-    size_t fk_sensor;
-    size_t fk_actuator;
+void new_actuator_event(actuator_t& actuator){
+    auto time    = std::chrono::steady_clock::now().time_since_epoch();
+    auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time);
 
-    condition(size_t pk_condition, std::string value, std::string op, size_t fk_sensor, size_t fk_actuator)
-        : pk_condition(pk_condition), value(value), op(op), fk_sensor(fk_sensor), fk_actuator(fk_actuator) {}
-};
+    if((time_ms - actuator.last_event).count() < 1200){
+        ASGARD_DEBUG << "asgard:rule: Ignore actuator event (too fast) " << actuator.id;
+        return;
+    }
+
+    actuator.last_event = time_ms;
 
-struct rule {
-    size_t pk_rule;
-    size_t fk_condition;
-    size_t fk_action;
-    size_t system_action;
-    std::string value;
-    condition* cond;
+    auto rules = get_rules();
 
-    rule(size_t pk_rule, size_t fk_condition, size_t fk_action, size_t system_action, std::string value)
-        : pk_rule(pk_rule), fk_condition(fk_condition), fk_action(fk_action), system_action(system_action), value(value), cond(nullptr) {}
+    // Reused by the events handled on this worker, run_rules copies what it keeps
+    thread_local std::vector<std::size_t> sequence;
+    sequence.clear();
 
-    condition& get_condition(){
-        return *cond;
+    for(auto& rule : rules->actuator(actuator.id_sql)){
+        sequence.push_back(rule.pk_rule);
     }
-};
 
-std::vector<rule> load_rules(){
-    std::vector<rule> rules;
+    run_rules(sequence);
+}
 
-    for(auto& data : get_db().execQuery("select pk_rule, fk_condition, fk_action, system_action, value from rule;")){
-        auto pk_rule       = data.getIntField(0);
-        auto fk_condition  = data.getIntField(1);
-        auto fk_action     = data.getIntField(2);
-        auto system_action = data.getIntField(3);
-        auto value         = data.fieldValue(4);
+void new_data(sensor_t& sensor, double data_value){
+    auto time    = std::chrono::steady_clock::now().time_since_epoch();
+    auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time);
 
-        rules.emplace_back(pk_rule, fk_condition, fk_action, system_action, value);
+    if((time_ms - sensor.last_event).count() < 750){
+        ASGARD_DEBUG << "asgard:rule: Ignore sensor event (too fast) " << sensor.id;
+        return;
     }
 
-    return rules;
+    auto first           = sensor.first;
+    auto last_data_value = sensor.last_value;
+
+    sensor.last_event = time_ms;
+
+    auto rules = get_rules();
+
+    // The conditions are evaluated now, even for the rules executed after a sleep
+    thread_local std::vector<std::size_t> sequence;
+    sequence.clear();
+
+    static auto& evaluations = get_counter("asgard_rule_evaluations_total", "Number of rule conditions evaluated");
+
+    for(auto& rule : rules->sensor(sensor.id_sql)){
+        evaluations.inc();
+
+        if(rule_matches(rule, data_value, last_data_value, first)){
+            sequence.push_back(rule.pk_rule);
+        }
+    }
+
+    if(!sequence.empty()){
+        run_rules(sequence);
+    }
+
+    sensor.last_value = data_value;
+    sensor.first = false;
 }
 
-std::vector<condition> load_conditions(){
-    std::vector<condition> conditions;
+struct connection_t {
+    int socket;
+    std::atomic<bool> binary{false}; ///< The driver uses the binary protocol
+    pooled_buffer input;  ///< Received bytes (incomplete binary frames)
+
+    std::mutex send_lock;
+    send_queue output;           ///< Messages not yet written, guarded by send_lock
+    bool wait_writable = false;  ///< EPOLLOUT is watched, guarded by send_lock
+    bool closed = false;         ///< The socket is closed, guarded by send_lock
+};
+
+// The driver connections, by socket
+std::mutex connections_lock;
+std::unordered_map<int, std::shared_ptr<connection_t>> connections;
 
-    for(auto& data : get_db().execQuery("select pk_condition, value, operator, fk_sensor, fk_actuator from condition;")){
-        auto pk_condition = data.getIntField(0);
-        auto value        = data.fieldValue(1);
-        auto op           = data.fieldValue(2);
-        auto fk_sensor    = data.getIntField(3);
-        auto fk_actuator  = data.getIntField(4);
+std::shared_ptr<connection_t> find_connection(int socket_fd){
+    std::lock_guard<std::mutex> l(connections_lock);
 
-        conditions.emplace_back(pk_condition, value, op, fk_sensor, fk_actuator);
+    auto it = connections.find(socket_fd);
+    return it == connections.end() ? nullptr : it->second;
+}
+
+bool is_binary(int socket_fd){
+    auto connection = find_connection(socket_fd);
+    return connection && connection->binary;
+}
+
+void watch_writable(connection_t& connection, bool writable){
+    if(connection.wait_writable == writable){
+        return;
+    }
+
+    struct epoll_event event;
+    event.events  = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = connection.socket;
+
+    if(writable){
+        event.events |= EPOLLOUT;
     }
 
-    return conditions;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.socket, &event) < 0){
+        ASGARD_ERROR << "asgard: server: failed to watch the connection: " << std::strerror(errno);
+        return;
+    }
+
+    connection.wait_writable = writable;
 }
 
-bool bind_rules(std::vector<rule>& rules, std::vector<condition>& conditions){
-    for(auto& rule : rules){
-        bool found = false;
+// Must be called with the send lock of the connection
+bool flush_connection(connection_t& connection){
+    switch(connection.output.flush(connection.socket)){
+        case send_queue::status::FLUSHED:
+            watch_writable(connection, false);
+            return true;
 
-        for(auto& condition : conditions){
-            if(condition.pk_condition == rule.fk_condition){
-                rule.cond = &condition;
-                found = true;
-                break;
-            }
-        }
+        case send_queue::status::PENDING:
+            // The rest is written by the event loop
+            watch_writable(connection, true);
+            return true;
 
-        if(!found){
-            std::cerr << "ERROR: asgard: Invalid link in database pk_condition <> fk_condition" << std::endl;
+        case send_queue::status::FAILED:
+        default:
+            ASGARD_ERROR << "asgard: server: failed to send message: " << std::strerror(errno);
             return false;
-        }
     }
+}
 
-    return true;
+// Queue a message for the driver, each connection has its own queue and lock
+bool send_to_connection(int socket_fd, const char* data, std::size_t size){
+    auto connection = find_connection(socket_fd);
+
+    if (!connection) {
+        ASGARD_ERROR << "asgard: server: Invalid connection (fd:" << socket_fd << ")";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> l(connection->send_lock);
+
+    if (connection->closed) {
+        return false;
+    }
+
+    if (!connection->output.push(data, size)) {
+        ASGARD_WARNING << "asgard: server: send queue full, drop message (fd:" << socket_fd << ")";
+        return false;
+    }
+
+    // When the socket is full, keep the order and let the event loop write
+    if (connection->wait_writable) {
+        return true;
+    }
+
+    return flush_connection(*connection);
 }
 
-void execute_rule(rule& rule){
-    std::cout << "asgard: Execute rule " << rule.pk_rule << std::endl;
+// Give an id back to the client, in the protocol of the connection
+bool answer_id(int socket_fd, std::size_t id){
+    if (is_binary(socket_fd)) {
+        frame_writer writer(binary_command::ID);
+        writer.write_u32(id);
 
-    if(rule.fk_action){
-        // Get the action from the database
+        auto& frame = writer.frame();
+        return send_to_connection(socket_fd, frame.data(), frame.size());
+    }
 
-        CppSQLite3Query action_query = db_exec_query(get_db(), "select fk_source, type, name from action where pk_action = %d;", rule.fk_action);
+    char answer[32];
+    auto nbytes = snprintf(answer, sizeof(answer), "%d", (int) id);
+    return send_to_connection(socket_fd, answer, nbytes);
+}
 
-        if(action_query.eof()){
-            std::cerr << "ERROR: asgard: Invalid link in database pk_condition <> fk_condition" << std::endl;
-            return;
-        }
+metric_gauge& sources_gauge(){
+    static auto& sources = get_gauge("asgard_sources", "Number of sources registered by the drivers");
+    return sources;
+}
 
-        auto fk_source          = action_query.getIntField(0);
-        std::string action_type = action_query.fieldValue(1);
-        std::string action_name = action_query.fieldValue(2);
+void reg_source(int socket_fd, const std::string& name, bool binary){
+    auto source = registry.add_source(name, socket_fd);
 
-        // Make sure the driver is active
+    // Give the source id back to the client (always as text)
+    char answer[32];
+    auto nbytes = snprintf(answer, sizeof(answer), "%d", (int)source->id);
+    if (!send_to_connection(socket_fd, answer, nbytes)) {
+        return;
+    }
 
-        if(!source_sql_exists(fk_source)){
-            std::cerr << "ERROR: asgard: The source for the action is not active" << std::endl;
-            return;
+    if (binary) {
+        if (auto connection = find_connection(socket_fd)) {
+            connection->binary = true;
         }
+    }
 
-        // Get the client address from the SQL id
+    db_exec_dml(get_db(), "insert into source(name,fk_pi) select \"%s\", 1 where not exists(select 1 from source where name=\"%s\");",
+                source->name.c_str(), source->name.c_str());
+    registry.set_source_sql(*source, db_exec_scalar(get_db(), "select pk_source from source where name=\"%s\";", source->name.c_str()));
 
-        auto client_addr = source_addr_from_sql(fk_source);
+    // The home page lists the devices
+    invalidate_fragments();
 
-        // Execute the action
+    sources_gauge().inc();
 
-        if(action_type == "SIMPLE"){
-            send_to_driver(client_addr, "ACTION " + action_name);
-        } else {
-            send_to_driver(client_addr, "ACTION " + action_name + " " + rule.value);
-        }
+    ASGARD_INFO << "asgard: new source registered " << source->id << " : " << source->name << (binary ? " (binary)" : "");
+}
+
+void unreg_source(std::size_t source_id){
+    if (!registry.remove_source(source_id)) {
+        ASGARD_ERROR << "asgard: server: Invalid request for source id " << source_id;
     } else {
-        // Execute a system action
+        sources_gauge().dec();
+    }
 
-        if(rule.system_action == 1){
-            auto time = std::atoi(rule.value.c_str());
-            std::this_thread::sleep_for(std::chrono::seconds(time));
-        }
+    ASGARD_INFO << "asgard: unregistered source " << source_id;
+}
+
+void reg_sensor(int socket_fd, std::size_t source_id, const std::string& type, const std::string& name){
+    auto source = registry.source(source_id);
+
+    if (!source) {
+        ASGARD_ERROR << "asgard: server: Invalid request for source id " << source_id;
+        return;
+    }
+
+    auto sensor  = registry.add_sensor(*source);
+    sensor->type = type;
+    sensor->name = name;
+
+    // Give the sensor id back to the client, the next DATA must not find a sensor without history
+    if (!answer_id(socket_fd, sensor->id)) {
+        registry.remove_sensor(source_id, sensor->id);
+        return;
+    }
+
+    if(db_exec_dml(
+        get_db(), "insert into sensor(type, name, fk_source) select \"%s\", \"%s\","
+        "%d where not exists(select 1 from sensor where type=\"%s\" and name=\"%s\");"
+        , sensor->type.c_str(), sensor->name.c_str(), source->id_sql, sensor->type.c_str(), sensor->name.c_str())) {
+
+        auto sensor_type = sensor->type;
+        std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
+        std::string url = "/" + sensor->name + "/" + sensor_type;
+        controller.addRoute<display_controller>("GET", url + "/data", &display_controller::sensor_data);
+        controller.addRoute<display_controller>("GET", url + "/script", &display_controller::sensor_script);
+        controller.addRoute<display_controller>("GET", "/api/sensors" + url + "/history", &display_controller::sensor_history_api);
     }
+
+    // Get the SQL ID
+
+    sensor->id_sql = db_exec_scalar(get_db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor->name.c_str(), sensor->type.c_str());
+
+    // The legacy history not yet converted is still in sensor_data
+    sensor->history = load_history(sensor_histories, sensor->id_sql,
+        "select time / 1000, value from sensor_value where fk_sensor=%d "
+        "union all select cast(strftime('%s', time) as integer), data from sensor_data where fk_sensor=%d "
+        "order by 1 desc limit %d;", sensor->id_sql, sensor->id_sql, sample_buffer::capacity);
+
+    // The home page lists the devices
+    invalidate_fragments();
+
+    ASGARD_INFO << "asgard: new sensor registered " << sensor->id << " (" << sensor->type << ") : " << sensor->name;
 }
 
-void new_actuator_event(source_t& /*source*/, actuator_t& actuator){
-    auto time    = std::chrono::steady_clock::now().time_since_epoch();
-    auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time);
+void unreg_sensor(std::size_t source_id, std::size_t sensor_id){
+    if (!registry.remove_sensor(source_id, sensor_id)) {
+        ASGARD_ERROR << "asgard: server: Invalid request for sensor " << source_id << ":" << sensor_id;
+    }
 
-    if((time_ms - actuator.last_event).count() < 1200){
-        std::cout << "asgard:rule: Ignore actuator event (too fast) " << actuator.id << std::endl;
+    ASGARD_INFO << "asgard: sensor unregistered from source " << source_id << " : " << sensor_id;
+}
+
+void reg_action(int socket_fd, std::size_t source_id, const std::string& type, const std::string& name){
+    auto source = registry.source(source_id);
+
+    if (!source) {
+        ASGARD_ERROR << "asgard: server: Invalid request for source id " << source_id;
         return;
     }
 
-    actuator.last_event = time_ms;
+    auto action  = registry.add_action(*source);
+    action->type = type;
+    action->name = name;
 
-    auto rules      = load_rules();
-    auto conditions = load_conditions();
+    // Give the action id back to the client
+    if (!answer_id(socket_fd, action->id)) {
+        registry.remove_action(source_id, action->id);
+        return;
+    }
+
+    // Insert the action into the DB if it does not exist already
+    db_exec_dml(get_db(), "insert into action(type, name, fk_source) select \"%s\", \"%s\", %d where not exists(select 1 from action where type=\"%s\" and name=\"%s\");",
+                action->type.c_str(), action->name.c_str(), source->id_sql, action->type.c_str(), action->name.c_str());
+
+    // Register the route for the action
+    controller.addRoute<display_controller>("GET", "/action/" + source->name + "/" + action->name, &display_controller::action);
+
+    ASGARD_INFO << "asgard: new action registered " << action->id << " (" << action->type << ") : " << action->name;
+}
+
+void unreg_action(std::size_t source_id, std::size_t action_id){
+    if (!registry.remove_action(source_id, action_id)) {
+        ASGARD_ERROR << "asgard: server: Invalid request for action " << source_id << ":" << action_id;
+    }
+
+    ASGARD_INFO << "asgard: action unregistered from source " << source_id << " : " << action_id;
+}
+
+void reg_actuator(int socket_fd, std::size_t source_id, const std::string& name){
+    // Get the source
 
-    if(!bind_rules(rules, conditions)){
+    auto source = registry.source(source_id);
+
+    if (!source) {
+        ASGARD_ERROR << "asgard: server: Invalid request for source id " << source_id;
         return;
     }
 
-    std::cout << "DEBUG asgard:rules: Loaded " << rules.size() << " rules" << std::endl;
-    std::cout << "DEBUG asgard:rules: Loaded " << conditions.size() << " conditions" << std::endl;
+    // Create a new actuator
 
-    for(auto& rule : rules){
-        auto& condition = rule.get_condition();
+    auto actuator  = registry.add_actuator(*source);
+    actuator->name = name;
 
-        if(!condition.fk_sensor && condition.fk_actuator == actuator.id_sql){
-            execute_rule(rule);
-        }
+    // Give the actuator id back to the client, the next EVENT must not find an actuator without history
+
+    if (!answer_id(socket_fd, actuator->id)) {
+        registry.remove_actuator(source_id, actuator->id);
+        return;
     }
+
+    // Insert into the database if necessary
+
+    db_exec_dml(get_db(), "insert into actuator(name, fk_source) select \"%s\", %d where not exists(select 1 from actuator where name=\"%s\");",
+                actuator->name.c_str(), source->id_sql, actuator->name.c_str());
+
+    // Add the route
+
+    std::string url = "/" + actuator->name;
+    controller.addRoute<display_controller>("GET", url + "/data", &display_controller::actuator_data);
+    controller.addRoute<display_controller>("GET", url + "/script", &display_controller::actuator_script);
+    controller.addRoute<display_controller>("GET", "/api/actuators" + url + "/history", &display_controller::actuator_history_api);
+
+    // Get the SQL ID
+
+    actuator->id_sql = db_exec_scalar(get_db(), "select pk_actuator from actuator where name=\"%s\";", actuator->name.c_str());
+
+    actuator->history = load_history(actuator_histories, actuator->id_sql,
+        "select strftime('%s', time), data from actuator_data where fk_actuator=%d order by time desc limit %d;", actuator->id_sql, sample_buffer::capacity);
+
+    // The home page lists the devices
+    invalidate_fragments();
+
+    ASGARD_INFO << "asgard: new actuator registered " << actuator->id << " : " << actuator->name << " (sql:" << actuator->id_sql << ")";
 }
 
-void new_data(sensor_t& sensor, std::string data){
-    auto time    = std::chrono::steady_clock::now().time_since_epoch();
-    auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(time);
+void unreg_actuator(std::size_t source_id, std::size_t actuator_id){
+    if (!registry.remove_actuator(source_id, actuator_id)) {
+        ASGARD_ERROR << "asgard: server: Invalid request for actuator " << source_id << ":" << actuator_id;
+    }
 
-    if((time_ms - sensor.last_event).count() < 750){
-        std::cout << "asgard:rule: Ignore sensor event (too fast) " << sensor.id << std::endl;
+    ASGARD_INFO << "asgard: actuator unregistered from source " << source_id << " : " << actuator_id;
+}
+
+void receive_data(std::size_t source_id, std::size_t sensor_id, double value, token data){
+    auto sensor = registry.sensor(source_id, sensor_id);
+
+    if (!sensor) {
+        ASGARD_ERROR << "asgard: server: Invalid request for sensor " << source_id << ":" << sensor_id;
         return;
     }
 
-    auto first     = sensor.first;
-    auto last_data = sensor.last_data;
+    auto first = sensor->history->empty();
 
-    sensor.last_event = time_ms;
+    sensor->history->push(std::time(nullptr), value, data.data, data.size);
 
-    auto data_value      = std::atof(data.c_str());
-    auto last_data_value = std::atof(last_data.c_str());
+    // A sensor is shown on the home page once it has a value
+    if(first){
+        invalidate_fragments();
+    }
+
+    // The sample is written by the database writer thread
+    if(!push_sensor_data(sensor->id_sql, value, data.data, data.size)){
+        ASGARD_WARNING << "asgard: server: database queue full, drop data from sensor " << sensor->name;
+    }
 
-    auto rules      = load_rules();
-    auto conditions = load_conditions();
+    publish_event(stream_kind::SENSOR, sensor->id_sql, data.data, data.size);
 
-    if(!bind_rules(rules, conditions)){
+    ASGARD_DEBUG << "asgard: server: new data: sensor(" << sensor->type << "): \"" << sensor->name << "\" : " << data.str();
+
+    // The rules of one sensor are evaluated in order
+    if(!try_execute_task(sensor->id_sql * 2, [sensor, value](){ new_data(*sensor, value); })){
+        ASGARD_WARNING << "asgard: server: rules queue full, drop data from sensor " << sensor->name;
+    }
+}
+
+void receive_event(std::size_t source_id, std::size_t actuator_id, token data){
+    auto actuator = registry.actuator(source_id, actuator_id);
+
+    if (!actuator) {
+        ASGARD_ERROR << "asgard: server: Invalid request for actuator " << source_id << ":" << actuator_id;
         return;
     }
 
-    std::cout << "DEBUG asgard:rules: Loaded " << rules.size() << " rules" << std::endl;
-    std::cout << "DEBUG asgard:rules: Loaded " << conditions.size() << " conditions" << std::endl;
+    // The token is not null-terminated in the binary frames
+    char value[max_sample_size + 1];
+    auto size = std::min(data.size, max_sample_size);
+    std::memcpy(value, data.data, size);
+    value[size] = '\0';
 
-    for(auto& rule : rules){
-        auto& condition = rule.get_condition();
+    auto first = actuator->history->empty();
 
-        if(!condition.fk_actuator && condition.fk_sensor == sensor.id_sql){
-            auto condition_value = std::atof(condition.value.c_str());
+    actuator->history->push(std::time(nullptr), std::atof(value), value, size);
 
-            if(condition.op == "=="){
-                if(data_value == condition_value){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "!="){
-                if(data_value != condition_value){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == ">"){
-                if(data_value > condition_value){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == ">="){
-                if(data_value >= condition_value){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "<"){
-                if(data_value < condition_value){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "<="){
-                if(data_value <= condition_value){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "== (once)"){
-                if(data_value == condition_value && (first || !(last_data_value == condition_value))){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "!= (once)"){
-                if(data_value != condition_value && (first || !(last_data_value != condition_value))){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "> (once)"){
-                if(data_value > condition_value && (first || !(last_data_value > condition_value))){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == ">= (once)"){
-                if(data_value >= condition_value && (first || !(last_data_value >= condition_value))){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "< (once)"){
-                if(data_value < condition_value && (first || !(last_data_value < condition_value))){
-                    execute_rule(rule);
-                }
-            } else if(condition.op == "<= (once)"){
-                if(data_value <= condition_value && (first || !(last_data_value <= condition_value))){
-                    execute_rule(rule);
-                }
-            } else {
-                std::cerr << "ERROR asgard: Invalid condition operator " << condition.op << std::endl;
-            }
-        }
+    // An actuator is shown on the home page once it has a value
+    if(first){
+        invalidate_fragments();
     }
 
-    sensor.last_data = data;
-    sensor.first = false;
+    // The event is written by the database writer thread
+    if(!push_actuator_data(actuator->id_sql, value, size)){
+        ASGARD_WARNING << "asgard: server: database queue full, drop event from actuator " << actuator->name;
+    }
+
+    publish_event(stream_kind::ACTUATOR, actuator->id_sql, value, size);
+
+    ASGARD_DEBUG << "asgard: server: new event: actuator: \"" << actuator->name << "\" : " << value;
+
+    // The rules of one actuator are evaluated in order
+    if(!try_execute_task(actuator->id_sql * 2 + 1, [actuator](){ new_actuator_event(*actuator); })){
+        ASGARD_WARNING << "asgard: server: rules queue full, drop event from actuator " << actuator->name;
+    }
 }
 
-bool handle_command(const std::string& message, int socket_fd) {
-    std::stringstream message_ss(message);
+// The handlers of the text commands, they return false to close the connection
+using command_handler = bool (*)(tokenizer& tokens, int socket_fd);
 
-    std::string command;
-    message_ss >> command;
+const char binary_mode[] = "BINARY";
+constexpr std::size_t binary_mode_size = sizeof(binary_mode) - 1;
 
-    if (command == "REG_SOURCE") {
-        sources.emplace_back();
+// The first frames can follow "BINARY" in the same read, without a separator
+bool is_binary_mode(const token& mode){
+    return mode.size >= binary_mode_size && std::memcmp(mode.data, binary_mode, binary_mode_size) == 0;
+}
 
-        auto& source             = sources.back();
-        source.id                = current_source++;
-        source.sensors_counter   = 0;
-        source.actuators_counter = 0;
-        source.actions_counter   = 0;
-        source.socket            = socket_fd;
+bool command_reg_source(tokenizer& tokens, int socket_fd){
+    auto name = tokens.next();
+    auto mode = tokens.next();
 
-        message_ss >> source.name;
+    reg_source(socket_fd, name.str(), is_binary_mode(mode));
 
-        // Give the source id back to the client
-        auto nbytes = snprintf(write_buffer, 4096, "%d", (int)source.id);
-        if (!asgard::send_message(socket_fd, write_buffer, nbytes)) {
-            std::perror("asgard: server: failed to answer");
-            return true;
-        }
+    return true;
+}
 
-        try {
-            CppSQLite3Buffer buffSQL;
-            buffSQL.format("insert into source(name,fk_pi) select \"%s\", 1 where not exists(select 1 from source where name=\"%s\");",
-                           source.name.c_str(), source.name.c_str());
-            get_db().execDML(buffSQL);
-            buffSQL.format("select pk_source from source where name=\"%s\";", source.name.c_str());
-            source.id_sql = get_db().execScalar(buffSQL);
-        } catch (CppSQLite3Exception& e) {
-            std::cerr << e.errorCode() << ":" << e.errorMessage() << std::endl;
-        }
+bool command_unreg_source(tokenizer& tokens, int /*socket_fd*/){
+    std::size_t source_id;
+    if(tokens.next_id(source_id)){
+        unreg_source(source_id);
+    }
+
+    return false;
+}
 
-        std::cout << "asgard: new source registered " << source.id << " : " << source.name << std::endl;
-    } else if (command == "UNREG_SOURCE") {
-        int source_id;
-        message_ss >> source_id;
+bool command_reg_sensor(tokenizer& tokens, int socket_fd){
+    std::size_t source_id;
+    if(tokens.next_id(source_id)){
+        auto type = tokens.next();
+        auto name = tokens.next();
 
-        sources.erase(std::remove_if(sources.begin(), sources.end(), [&](source_t& source) {
-                          return source.id == static_cast<std::size_t>(source_id);
-                      }), sources.end());
+        reg_sensor(socket_fd, source_id, type.str(), name.str());
+    }
 
-        std::cout << "asgard: unregistered source " << source_id << std::endl;
+    return true;
+}
 
-        return false;
-    } else if (command == "REG_SENSOR") {
-        int source_id;
-        message_ss >> source_id;
+bool command_unreg_sensor(tokenizer& tokens, int /*socket_fd*/){
+    std::size_t source_id;
+    std::size_t sensor_id;
+    if(tokens.next_id(source_id) && tokens.next_id(sensor_id)){
+        unreg_sensor(source_id, sensor_id);
+    }
 
-        auto& source = select_source(source_id);
+    return true;
+}
 
-        source.sensors.emplace_back();
-        auto& sensor      = source.sensors.back();
-        sensor.last_event = std::chrono::milliseconds::zero();
-        sensor.last_data  = "";
-        sensor.first      = true;
+bool command_reg_action(tokenizer& tokens, int socket_fd){
+    std::size_t source_id;
+    if(tokens.next_id(source_id)){
+        auto type = tokens.next();
+        auto name = tokens.next();
 
-        message_ss >> sensor.type;
-        message_ss >> sensor.name;
+        reg_action(socket_fd, source_id, type.str(), name.str());
+    }
 
-        sensor.id = source.sensors_counter++;
+    return true;
+}
 
-        // Give the sensor id back to the client
-        auto nbytes = snprintf(write_buffer, 4096, "%d", (int) sensor.id);
-        if (!asgard::send_message(socket_fd, write_buffer, nbytes)) {
-            std::perror("asgard: server: failed to answer");
-            return true;
+bool command_unreg_action(tokenizer& tokens, int /*socket_fd*/){
+    std::size_t source_id;
+    std::size_t action_id;
+    if(tokens.next_id(source_id) && tokens.next_id(action_id)){
+        unreg_action(source_id, action_id);
+    }
+
+    return true;
+}
+
+bool command_reg_actuator(tokenizer& tokens, int socket_fd){
+    std::size_t source_id;
+    if(tokens.next_id(source_id)){
+        auto name = tokens.next();
+
+        reg_actuator(socket_fd, source_id, name.str());
+    }
+
+    return true;
+}
+
+bool command_unreg_actuator(tokenizer& tokens, int /*socket_fd*/){
+    std::size_t source_id;
+    std::size_t actuator_id;
+    if(tokens.next_id(source_id) && tokens.next_id(actuator_id)){
+        unreg_actuator(source_id, actuator_id);
+    }
+
+    return true;
+}
+
+bool command_data(tokenizer& tokens, int /*socket_fd*/){
+    std::size_t source_id;
+    std::size_t sensor_id;
+    double value;
+    token text;
+    if(tokens.next_id(source_id) && tokens.next_id(sensor_id) && tokens.next_double(value, text)){
+        receive_data(source_id, sensor_id, value, text);
+    }
+
+    return true;
+}
+
+bool command_event(tokenizer& tokens, int /*socket_fd*/){
+    std::size_t source_id;
+    std::size_t actuator_id;
+    if(tokens.next_id(source_id) && tokens.next_id(actuator_id)){
+        receive_event(source_id, actuator_id, tokens.next());
+    }
+
+    return true;
+}
+
+// The token is sent back, the drivers measure the round trip through the event loop
+bool command_ping(tokenizer& tokens, int socket_fd){
+    auto payload = tokens.next();
+
+    if(payload.empty()){
+        send_to_connection(socket_fd, "PONG", 4);
+    } else {
+        send_to_connection(socket_fd, payload.data, payload.size);
+    }
+
+    return true;
+}
+
+struct command_entry {
+    const char* name;
+    std::size_t size;
+    command_handler handler;
+};
+
+#define COMMAND(name, handler) {name, sizeof(name) - 1, handler}
+
+// DATA and EVENT are by far the most frequent commands, they are tried first
+const command_entry commands[] = {
+    COMMAND("DATA", command_data),
+    COMMAND("EVENT", command_event),
+    COMMAND("REG_SOURCE", command_reg_source),
+    COMMAND("UNREG_SOURCE", command_unreg_source),
+    COMMAND("REG_SENSOR", command_reg_sensor),
+    COMMAND("UNREG_SENSOR", command_unreg_sensor),
+    COMMAND("REG_ACTION", command_reg_action),
+    COMMAND("UNREG_ACTION", command_unreg_action),
+    COMMAND("REG_ACTUATOR", command_reg_actuator),
+    COMMAND("UNREG_ACTUATOR", command_unreg_actuator),
+    COMMAND("PING", command_ping),
+};
+
+#undef COMMAND
+
+const std::size_t n_commands = sizeof(commands) / sizeof(commands[0]);
+
+metric_histogram& command_latency(const std::string& name){
+    return get_histogram("asgard_command_duration_seconds", "Time to handle a command of a driver", "command=\"" + name + "\"");
+}
+
+// The histograms are resolved once, the commands are on the hot path
+metric_histogram& text_command_latency(std::size_t i){
+    static const auto latencies = [](){
+        std::vector<metric_histogram*> latencies;
+        for(auto& entry : commands){
+            latencies.push_back(&command_latency(entry.name));
         }
+        return latencies;
+    }();
 
-        if(db_exec_dml(
-            get_db(), "insert into sensor(type, name, fk_source) select \"%s\", \"%s\","
-            "%d where not exists(select 1 from sensor where type=\"%s\" and name=\"%s\");"
-            , sensor.type.c_str(), sensor.name.c_str(), source.id_sql, sensor.type.c_str(), sensor.name.c_str())) {
+    return *latencies[i];
+}
 
-            auto sensor_type = sensor.type;
-            std::transform(sensor_type.begin(), sensor_type.end(), sensor_type.begin(), ::tolower);
-            std::string url = "/" + sensor.name + "/" + sensor_type;
-            controller.addRoute<display_controller>("GET", url + "/data", &display_controller::sensor_data);
-            controller.addRoute<display_controller>("GET", url + "/script", &display_controller::sensor_script);
+metric_histogram& binary_command_latency(std::uint8_t command){
+    static const auto latencies = [](){
+        std::vector<metric_histogram*> latencies;
+        for(std::size_t i = 0; i <= static_cast<std::size_t>(binary_command::ID); ++i){
+            latencies.push_back(&command_latency(binary_command_name(i)));
         }
+        return latencies;
+    }();
 
-        // Get the SQL ID
+    return *latencies[command < latencies.size() ? command : 0];
+}
 
-        sensor.id_sql = db_exec_scalar(get_db(), "select pk_sensor from sensor where name=\"%s\";", sensor.name.c_str());
+bool handle_command(const char* message, int socket_fd) {
+    tokenizer tokens(message);
 
-        std::cout << "asgard: new sensor registered " << sensor.id << " (" << sensor.type << ") : " << sensor.name << std::endl;
-    } else if (command == "UNREG_SENSOR") {
-        int source_id;
-        message_ss >> source_id;
+    auto command = tokens.next();
 
-        int sensor_id;
-        message_ss >> sensor_id;
+    for(std::size_t i = 0; i < n_commands; ++i){
+        auto& entry = commands[i];
+        if(entry.size == command.size && std::memcmp(entry.name, command.data, command.size) == 0){
+            latency_timer timer(text_command_latency(i));
+            return entry.handler(tokens, socket_fd);
+        }
+    }
 
-        auto& source = select_source(source_id);
+    static auto& unknown_commands = get_counter("asgard_unknown_commands_total", "Number of commands not understood by the server");
+    unknown_commands.inc();
 
-        source.sensors.erase(std::remove_if(source.sensors.begin(), source.sensors.end(), [&](sensor_t& sensor) {
-                                 return sensor.id == static_cast<std::size_t>(sensor_id);
-                             }), source.sensors.end());
+    ASGARD_ERROR << "asgard: server: Unknown command: " << message;
 
-        std::cout << "asgard: sensor unregistered from source " << source_id << " : " << sensor_id << std::endl;
-    } else if (command == "REG_ACTION") {
-        int source_id;
-        message_ss >> source_id;
+    return true;
+}
 
-        auto& source = select_source(source_id);
+bool handle_binary_command(const char* frame, std::size_t size, int socket_fd) {
+    frame_reader reader(frame + frame_header_size, size - frame_header_size);
 
-        source.actions.emplace_back();
-        auto& action = source.actions.back();
+    std::uint8_t command;
+    std::uint32_t source_id = 0;
+    std::uint32_t device_id = 0;
+    std::string type;
+    std::string name;
+    double value = 0.0;
 
-        message_ss >> action.type;
-        message_ss >> action.name;
+    if (!reader.read_u8(command) || !reader.read_u32(source_id)) {
+        ASGARD_ERROR << "asgard: server: Invalid binary frame";
+        return true;
+    }
 
-        action.id = source.actions_counter++;
+    latency_timer timer(binary_command_latency(command));
 
-        // Give the action id back to the client
-        auto nbytes = snprintf(write_buffer, 4096, "%d", action.id);
-        if (!asgard::send_message(socket_fd, write_buffer, nbytes)) {
-            std::perror("asgard: server: failed to answer");
-            return true;
-        }
+    bool valid = true;
 
-        // Insert the action into the DB if it does not exist already
-        db_exec_dml(get_db(), "insert into action(type, name, fk_source) select \"%s\", \"%s\",% d where not exists(select 1 from action where type=\"%s\" and name=\"%s\");",
-                    action.type.c_str(), action.name.c_str(), source.id_sql, action.type.c_str(), action.name.c_str());
+    switch (static_cast<binary_command>(command)) {
+        case binary_command::UNREG_SOURCE:
+            unreg_source(source_id);
+            return false;
 
-        // Register the route for the action
-        controller.addRoute<display_controller>("GET", "/action/" + source.name + "/" + action.name, &display_controller::action);
+        case binary_command::REG_SENSOR:
+        case binary_command::REG_ACTION:
+            valid = reader.read_string(type) && reader.read_string(name);
 
-        std::cout << "asgard: new action registered " << action.id << " (" << action.type << ") : " << action.name << std::endl;
-    } else if (command == "UNREG_ACTION") {
-        int source_id;
-        message_ss >> source_id;
+            if (valid && static_cast<binary_command>(command) == binary_command::REG_SENSOR) {
+                reg_sensor(socket_fd, source_id, type, name);
+            } else if (valid) {
+                reg_action(socket_fd, source_id, type, name);
+            }
 
-        int action_id;
-        message_ss >> action_id;
+            break;
 
-        auto& source = select_source(source_id);
+        case binary_command::REG_ACTUATOR:
+            valid = reader.read_string(name);
 
-        source.actions.erase(std::remove_if(source.actions.begin(), source.actions.end(), [&](action_t& action) {
-                                 return action.id == static_cast<std::size_t>(action_id);
-                             }), source.actions.end());
+            if (valid) {
+                reg_actuator(socket_fd, source_id, name);
+            }
 
-        std::cout << "asgard: action unregistered from source " << source_id << " : " << action_id << std::endl;
-    } else if (command == "REG_ACTUATOR") {
-        // Get the source
+            break;
 
-        int source_id;
-        message_ss >> source_id;
+        case binary_command::UNREG_SENSOR:
+        case binary_command::UNREG_ACTUATOR:
+        case binary_command::UNREG_ACTION:
+            valid = reader.read_u32(device_id);
+
+            if (valid && static_cast<binary_command>(command) == binary_command::UNREG_SENSOR) {
+                unreg_sensor(source_id, device_id);
+            } else if (valid && static_cast<binary_command>(command) == binary_command::UNREG_ACTUATOR) {
+                unreg_actuator(source_id, device_id);
+            } else if (valid) {
+                unreg_action(source_id, device_id);
+            }
 
-        auto& source = select_source(source_id);
+            break;
 
-        // Create a new actuator
+        case binary_command::DATA:
+            valid = reader.read_u32(device_id) && reader.read_f64(value);
 
-        source.actuators.emplace_back();
-        auto& actuator = source.actuators.back();
-        actuator.last_event = std::chrono::milliseconds::zero();
+            if (valid) {
+                // The shortest text giving back the exact value
+                char text[32];
+                auto n = snprintf(text, sizeof(text), "%.15g", value);
+                if (std::strtod(text, nullptr) != value) {
+                    n = snprintf(text, sizeof(text), "%.17g", value);
+                }
 
-        message_ss >> actuator.name;
+                receive_data(source_id, device_id, value, {text, std::size_t(n)});
+            }
 
-        // Get the internal ID
+            break;
 
-        actuator.id = source.actuators_counter++;
+        case binary_command::EVENT:
+            valid = reader.read_u32(device_id) && reader.read_string(name);
 
-        // Give the sensor id back to the client
+            if (valid) {
+                receive_event(source_id, device_id, {name.c_str(), name.size()});
+            }
 
-        auto nbytes = snprintf(write_buffer, 4096, "%d", (int) actuator.id);
-        if (!asgard::send_message(socket_fd, write_buffer, nbytes)) {
-            std::perror("asgard: server: failed to answer");
-            return true;
+            break;
+
+        default:
+            valid = false;
+            break;
+    }
+
+    if (!valid) {
+        ASGARD_ERROR << "asgard: server: Invalid binary frame (command " << int(command) << ")";
+    }
+
+    return true;
+}
+
+std::string get_config_string(const std::string& key, const std::string& default_value){
+    for(auto& entry : config){
+        if(entry.key == key){
+            return entry.value;
         }
+    }
+
+    return default_value;
+}
+
+int get_config_int(const std::string& key, int default_value){
+    auto value = get_config_string(key, "");
+    return value.empty() ? default_value : std::atoi(value.c_str());
+}
+
+// The raw retention of a sensor type is set with retention_raw_days_<type>
+retention_config load_retention_config(){
+    retention_config retention;
+
+    retention.raw_days      = get_config_int("retention_raw_days", default_retention_raw_days);
+    retention.rollup_days   = get_config_int("retention_rollup_days", default_retention_rollup_days);
+    retention.actuator_days = get_config_int("retention_actuator_days", default_retention_actuator_days);
+    retention.interval_s    = get_config_int("retention_interval_s", default_retention_interval_s);
+    retention.batch_size    = get_config_int("retention_batch_size", default_retention_batch_size);
+    retention.vacuum_pages  = get_config_int("retention_vacuum_pages", default_retention_vacuum_pages);
+
+    const std::string prefix = "retention_raw_days_";
+
+    for(auto& entry : config){
+        if(entry.key.compare(0, prefix.size(), prefix) == 0){
+            auto type = entry.key.substr(prefix.size());
+            std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+            retention.raw_days_by_type[type] = std::atoi(entry.value.c_str());
+
+            ASGARD_INFO << "asgard: retention: the raw " << type << " values are kept " << retention.raw_days_by_type[type] << " days";
+        }
+    }
+
+    // The pruning deletes history, the active policy is always reported
+    if (retention.raw_days || retention.rollup_days || retention.actuator_days || !retention.raw_days_by_type.empty()) {
+        ASGARD_WARNING << "asgard: retention: the data older than the policy is deleted (raw: " << retention.raw_days
+                       << " days, rollups: " << retention.rollup_days << " days, actuator events: " << retention.actuator_days << " days, 0 keeps forever)";
+    } else {
+        ASGARD_INFO << "asgard: retention: disabled, the data is kept forever";
+    }
+
+    return retention;
+}
+
+bool set_non_blocking(int fd){
+    auto flags = fcntl(fd, F_GETFL, 0);
+
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0){
+        ASGARD_ERROR << "asgard: server: failed to set socket non-blocking: " << std::strerror(errno);
+        return false;
+    }
+
+    return true;
+}
 
-        // Insert into the database if necessary
+void close_connection(int client_socket_fd){
+    std::shared_ptr<connection_t> connection;
 
-        db_exec_dml(get_db(), "insert into actuator(name, fk_source) select \"%s\", %d where not exists(select 1 from actuator where name=\"%s\");",
-                    actuator.name.c_str(), source.id_sql, actuator.name.c_str());
+    {
+        std::lock_guard<std::mutex> l(connections_lock);
 
-        // Add the route
+        auto it = connections.find(client_socket_fd);
+        if(it != connections.end()){
+            connection = std::move(it->second);
+            connections.erase(it);
+        }
+    }
 
-        std::string url = "/" + actuator.name;
-        controller.addRoute<display_controller>("GET", url + "/data", &display_controller::actuator_data);
-        controller.addRoute<display_controller>("GET", url + "/script", &display_controller::actuator_script);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_socket_fd, nullptr);
 
-        // Get the SQL ID
+    if(connection){
+        // The senders still holding the connection must not write to the descriptor once it is reused
+        std::lock_guard<std::mutex> l(connection->send_lock);
+        connection->closed = true;
+    }
 
-        actuator.id_sql = db_exec_scalar(get_db(), "select pk_actuator from actuator where name=\"%s\";", actuator.name.c_str());
+    // The sources are looked up by socket, they must not outlive it: the
+    // actions of a dead driver would be sent to the next driver on this descriptor
+    for(auto source_id : registry.remove_sources(client_socket_fd)){
+        sources_gauge().dec();
+        ASGARD_INFO << "asgard: unregistered source " << source_id << " (connection closed)";
+    }
 
-        std::cout << "asgard: new actuator registered " << actuator.id << " : " << actuator.name << " (sql:" << actuator.id_sql << ")" << std::endl;
-    } else if (command == "UNREG_ACTUATOR") {
-        int source_id;
-        message_ss >> source_id;
+    close(client_socket_fd);
 
-        int actuator_id;
-        message_ss >> actuator_id;
+    capture_disconnect(client_socket_fd);
 
-        auto& source = select_source(source_id);
+    --active_connections;
+    connections_gauge().set(active_connections);
 
-        source.actuators.erase(std::remove_if(source.actuators.begin(), source.actuators.end(), [&](actuator_t& actuator) {
-                                   return actuator.id == static_cast<std::size_t>(actuator_id);
-                               }), source.actuators.end());
+    ASGARD_DEBUG << "asgard: Connection closed (fd:" << client_socket_fd << ")";
+}
 
-        std::cout << "asgard: actuator unregistered from source " << source_id << " : " << actuator_id << std::endl;
-    } else if (command == "DATA") {
-        int source_id;
-        message_ss >> source_id;
+void accept_connections(int max_connections){
+    // The listening socket is non-blocking, drain the whole accept queue
+    while(true){
+        socklen_t socket_size = sizeof(struct sockaddr_in);
+        int client_socket_fd = accept(socket_desc, (struct sockaddr *)&client, &socket_size);
 
-        int sensor_id;
-        message_ss >> sensor_id;
+        if(client_socket_fd < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                ASGARD_ERROR << "accept failed: " << std::strerror(errno);
+            }
 
-        std::string data;
-        message_ss >> data;
+            return;
+        }
 
-        auto& source = select_source(source_id);
-        auto& sensor = source.sensors[sensor_id];
+        if(active_connections >= max_connections){
+            ASGARD_WARNING << "asgard: server: Too many connections (" << active_connections << "), reject new driver";
+            close(client_socket_fd);
+            continue;
+        }
 
-        int sensor_pk = db_exec_scalar(get_db(), "select pk_sensor from sensor where name=\"%s\" and type=\"%s\";", sensor.name.c_str(), sensor.type.c_str());
+        if(!set_non_blocking(client_socket_fd)){
+            close(client_socket_fd);
+            continue;
+        }
 
-        db_exec_dml(get_db(), "insert into sensor_data (data, fk_sensor) values (\"%s\", %d);", data.c_str(), sensor_pk);
+        struct epoll_event event;
+        event.events  = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = client_socket_fd;
 
-        std::cout << "asgard: server: new data: sensor(" << sensor.type << "): \"" << sensor.name << "\" : " << data << std::endl;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket_fd, &event) < 0){
+            ASGARD_ERROR << "asgard: server: failed to watch the connection: " << std::strerror(errno);
+            close(client_socket_fd);
+            continue;
+        }
 
-        std::thread([&sensor, data](){
-            new_data(sensor, data);
-        }).detach();
-    } else if (command == "EVENT") {
-        int source_id;
-        message_ss >> source_id;
+        ++active_connections;
+        connections_gauge().set(active_connections);
 
-        int actuator_id;
-        message_ss >> actuator_id;
+        capture_connect(client_socket_fd);
 
-        std::string data;
-        message_ss >> data;
+        auto connection    = std::make_shared<connection_t>();
+        connection->socket = client_socket_fd;
+        connection->input  = acquire_buffer();
 
-        auto& source   = select_source(source_id);
-        auto& actuator = source.actuators[actuator_id];
+        {
+            std::lock_guard<std::mutex> l(connections_lock);
+            connections[client_socket_fd] = std::move(connection);
+        }
 
-        int actuator_pk = db_exec_scalar(get_db(), "select pk_actuator from actuator where name=\"%s\";", actuator.name.c_str());
+        ASGARD_DEBUG << "asgard: New connection (fd:" << client_socket_fd << ")";
+    }
+}
 
-        db_exec_dml(get_db(), "insert into actuator_data (data, fk_actuator) values (\"%s\", %d);", data.c_str(), actuator_pk);
+// Handle all the complete frames of the input, the size of a frame is
+// checked as soon as its header is readable, before buffering its payload
+bool handle_frames(connection_t& connection) {
+    auto& input = connection.input->data;
 
-        std::cout << "asgard: server: new event: actuator: \"" << actuator.name << "\" : " << data << std::endl;
+    std::size_t consumed = 0;
+    while(auto frame_size = declared_frame_size(input.data() + consumed, input.size() - consumed)){
+        if(frame_size > max_frame_size){
+            ASGARD_ERROR << "asgard: server: Binary frame too large (" << frame_size << ")";
+            return false;
+        }
+
+        if(input.size() - consumed < frame_size){
+            break;
+        }
 
-        std::thread([&source, &actuator](){
-            new_actuator_event(source, actuator);
-        }).detach();
+        if(!handle_binary_command(input.data() + consumed, frame_size, connection.socket)){
+            return false;
+        }
+
+        consumed += frame_size;
     }
 
+    input.erase(input.begin(), input.begin() + consumed);
+
     return true;
 }
 
+bool binary_connection_handler(connection_t& connection) {
+    auto& input = connection.input->data;
+
+    auto previous = input.size();
+    input.resize(previous + socket_buffer_size);
+
+    auto n = read(connection.socket, input.data() + previous, socket_buffer_size);
+
+    if(n <= 0){
+        input.resize(previous);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+
+    input.resize(previous + n);
+
+    capture_message(connection.socket, input.data() + previous, n, true);
+
+    return handle_frames(connection);
+}
+
 void connection_handler(int client_socket_fd) {
-    while(asgard::receive_message(client_socket_fd, receive_buffer, socket_buffer_size)){
-        if(!handle_command(receive_buffer, client_socket_fd)){
-            break;
+    auto connection = find_connection(client_socket_fd);
+
+    if(!connection){
+        return;
+    }
+
+    if(connection->binary){
+        // Binary frames can be split or merged by TCP
+        if(!binary_connection_handler(*connection)){
+            close_connection(client_socket_fd);
+        }
+
+        return;
+    }
+
+    auto& input = connection->input->data;
+    input.resize(socket_buffer_size);
+
+    // Level-triggered: one message is read per readiness notification. The
+    // size is kept for the frames that can follow a binary registration
+    auto n = read(client_socket_fd, input.data(), socket_buffer_size - 1);
+
+    if(n <= 0){
+        if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            close_connection(client_socket_fd);
+        }
+
+        return;
+    }
+
+    input[n] = '\0';
+
+    capture_message(client_socket_fd, input.data(), n, false);
+
+    if(!handle_command(input.data(), client_socket_fd)){
+        close_connection(client_socket_fd);
+        return;
+    }
+
+    if(connection->binary){
+        // Keep only the bytes after "REG_SOURCE <name> BINARY" as binary input
+        tokenizer tokens(input.data());
+        tokens.next();
+        tokens.next();
+
+        auto end = static_cast<std::size_t>(tokens.next().data - input.data()) + binary_mode_size;
+
+        input.resize(n);
+        input.erase(input.begin(), input.begin() + end);
+
+        if(!handle_frames(*connection)){
+            close_connection(client_socket_fd);
         }
+    } else {
+        input.clear();
+    }
+}
+
+void writable_handler(int client_socket_fd) {
+    auto connection = find_connection(client_socket_fd);
+
+    if(!connection){
+        return;
+    }
+
+    std::lock_guard<std::mutex> l(connection->send_lock);
+
+    if(!connection->closed){
+        flush_connection(*connection);
     }
 }
 
@@ -643,9 +1179,14 @@ int run(){
    //Create socket
     socket_desc = socket(AF_INET, SOCK_STREAM, 0);
     if (socket_desc == -1) {
-        std::cout << "Could not create socket" << std::endl;
+        ASGARD_ERROR << "Could not create socket";
+        return 1;
     }
 
+    // Allow quick restarts of the server
+    int reuse = 1;
+    setsockopt(socket_desc, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     //Prepare the sockaddr_in structure
     server.sin_family = AF_INET;
     server.sin_addr.s_addr = INADDR_ANY;
@@ -654,88 +1195,239 @@ int run(){
     //Bind
     if (::bind(socket_desc, (struct sockaddr *)&server, sizeof(server)) < 0) {
         //print the error message
-        std::perror("bind failed. Error");
+        ASGARD_ERROR << "bind failed. Error: " << std::strerror(errno);
         return 1;
     }
 
+    auto listen_backlog  = get_config_int("server_listen_backlog", default_listen_backlog);
+    auto max_connections = get_config_int("server_max_connections", default_max_connections);
+
     //Listen
-    listen(socket_desc, 3);
+    if (listen(socket_desc, listen_backlog) < 0 || !set_non_blocking(socket_desc)) {
+        ASGARD_ERROR << "listen failed. Error: " << std::strerror(errno);
+        return 1;
+    }
 
-    std::cout << "asgard: server is ready to accept connections..." << std::endl;
+    // Create the event loop owning all the driver sockets
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        ASGARD_ERROR << "epoll_create failed. Error: " << std::strerror(errno);
+        return 1;
+    }
 
-    //Accept for incoming connection
-    int socket_size = sizeof(struct sockaddr_in);
-    int client_socket_fd;
-    while((client_socket_fd = accept(socket_desc, (struct sockaddr *)&client, (socklen_t*)&socket_size))) {
-        std::cout << "DEBUG: asgard: Launch new thread for new connection" << std::endl;
+    struct epoll_event listen_event;
+    listen_event.events  = EPOLLIN;
+    listen_event.data.fd = socket_desc;
 
-        threads.push_back(std::thread(connection_handler, client_socket_fd));
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_desc, &listen_event) < 0) {
+        ASGARD_ERROR << "epoll_ctl failed. Error: " << std::strerror(errno);
+        return 1;
     }
 
-    if (client_socket_fd < 0) {
-        std::perror("accept failed");
+    struct epoll_event stop_event;
+    stop_event.events  = EPOLLIN;
+    stop_event.data.fd = stop_pipe[0];
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_pipe[0], &stop_event) < 0) {
+        ASGARD_ERROR << "epoll_ctl failed. Error: " << std::strerror(errno);
         return 1;
     }
 
-    cleanup();
+    ASGARD_INFO << "asgard: server is ready to accept connections (backlog:" << listen_backlog << ", max:" << max_connections << ")...";
+
+    struct epoll_event events[max_events];
+
+    bool running = true;
+
+    // The capture is flushed every second, even without traffic
+    auto timeout = capture_enabled() ? 1000 : -1;
 
-    return 0;
+    while (running) {
+        auto n = epoll_wait(epoll_fd, events, max_events, timeout);
+
+        flush_capture();
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            ASGARD_ERROR << "epoll_wait failed: " << std::strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            auto fd = events[i].data.fd;
+
+            if (fd == socket_desc) {
+                accept_connections(max_connections);
+                continue;
+            }
+
+            if (fd == stop_pipe[0]) {
+                running = false;
+                continue;
+            }
+
+            // Write the pending messages of a driver that was too slow
+            if (events[i].events & EPOLLOUT) {
+                writable_handler(fd);
+            }
+
+            if (events[i].events & EPOLLIN) {
+                // Pending data is read before handling a hang up
+                connection_handler(fd);
+            } else if (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+                close_connection(fd);
+            }
+        }
+    }
+
+    return running ? 1 : 0;
 }
 
-void terminate(int /*signo*/) {
-    std::cout << "asgard: server: stopping the server" << std::endl;
+// Only async-signal-safe calls, the shutdown itself is done by main
+void request_stop(int /*signo*/) {
+    auto saved_errno = errno;
+    auto written = write(stop_pipe[1], "", 1);
+    (void) written;
+    errno = saved_errno;
+}
+
+void stop_server(Mongoose::Server& server) {
+    ASGARD_INFO << "asgard: server: stopping the server";
+
+    // The web threads and the timers submit work to the threads stopped after them
+    server.stop();
+    stop_scheduler();
+    stop_executor();
+    stop_db_writer();
+    stop_capture();
     cleanup();
-    abort();
+    stop_logger();
 }
 
 } //end of anonymous namespace
 
 int source_addr_from_sql(int id_sql){
-    auto& source = select_source_from_sql(id_sql);
-    return source.socket;
+    auto source = registry.source_from_sql(id_sql);
+
+    if (!source) {
+        ASGARD_ERROR << "asgard: server: Invalid request for source id sql " << id_sql;
+        return -1;
+    }
+
+    return source->socket;
 }
 
 bool source_sql_exists(std::size_t source_id) {
-    for (auto& source : sources) {
-        if (source.id_sql == source_id) {
-            return true;
-        }
-    }
+    return registry.source_from_sql(source_id) != nullptr;
+}
 
-    return false;
+std::shared_ptr<const sample_buffer> sensor_history(std::size_t sensor_pk){
+    return find_history(sensor_histories, sensor_pk);
+}
+
+std::shared_ptr<const sample_buffer> actuator_history(std::size_t actuator_pk){
+    return find_history(actuator_histories, actuator_pk);
 }
 
 bool send_to_driver(int client_address, const std::string& message){
-    auto nbytes = snprintf(write_buffer, 4096, "%s", message.c_str());
+    ASGARD_DEBUG << "asgard: Send message to driver (fd:" << client_address << "): " << message;
 
-    std::cout << "DEBUG: asgard: Send message to driver (fd:" << client_address << "): " << message << std::endl;
+    static auto& sent = get_counter("asgard_actions_sent_total", "Number of actions sent to the drivers");
+    sent.inc();
 
-    if (!asgard::send_message(client_address, write_buffer, nbytes)) {
-        std::perror("asgard: server: failed to send message");
-        return false;
+    if (is_binary(client_address)) {
+        // Translate "ACTION name [value]" into a binary frame
+        std::stringstream message_ss(message);
+
+        std::string command;
+        std::string name;
+        std::string value;
+        message_ss >> command >> name;
+        std::getline(message_ss >> std::ws, value);
+
+        frame_writer writer(binary_command::ACTION);
+        writer.write_string(name);
+        writer.write_string(value);
+
+        auto& frame = writer.frame();
+        return send_to_connection(client_address, frame.data(), frame.size());
     }
 
-    return true;
+    return send_to_connection(client_address, message.c_str(), message.size());
 }
 
 int main() {
     // Load the configuration file
     asgard::load_config(config);
 
+    // The console is written by a background thread from now on
+    set_log_level(parse_log_level(get_config_string("log_level", "info"), log_level::INFO));
+    start_logger();
+
     setup_led_controller();
 
     //Drop root privileges and run as pi:pi again
     if (!asgard::revoke_root()) {
-       std::cout << "asgard: unable to revoke root privileges, exiting..." << std::endl;
+       ASGARD_ERROR << "asgard: unable to revoke root privileges, exiting...";
        return 1;
     }
 
     // Open (connect) the database
     if(!db_connect(get_db())){
-       std::cout << "asgard: unable to connect to the database, exiting..." << std::endl;
+       ASGARD_ERROR << "asgard: unable to connect to the database, exiting...";
        return 1;
     }
 
+    // Compile the rules once, they are only reloaded when they change
+    reload_rules();
+
+    // The database writer prunes the old data
+    configure_retention(load_retention_config());
+
+    // Start the thread writing the samples into the database
+    if(!start_db_writer(
+        get_config_int("db_batch_size", default_db_batch_size),
+        get_config_int("db_batch_ms", default_db_batch_ms),
+        get_config_int("db_max_queue", default_db_max_queue))){
+       ASGARD_ERROR << "asgard: unable to start the database writer, exiting...";
+       return 1;
+    }
+
+    // Start the threads evaluating the rules
+    start_executor(
+        get_config_int("executor_threads", default_executor_threads),
+        get_config_int("executor_shards", default_executor_shards),
+        get_config_int("executor_capacity", default_executor_capacity),
+        parse_overflow_policy(get_config_string("executor_overflow", "drop_oldest")));
+
+    // Start the timers of the delayed rules
+    start_scheduler();
+
+    // The web clients wait for the live updates in the threads of the web server
+    auto events_max_waiting = get_config_int("events_max_waiting", default_events_max_waiting);
+    if (events_max_waiting < 0 || events_max_waiting > limit_events_max_waiting) {
+        ASGARD_WARNING << "asgard: server: events_max_waiting must be between 0 and " << limit_events_max_waiting
+                       << ", using " << default_events_max_waiting;
+        events_max_waiting = default_events_max_waiting;
+    }
+
+    configure_event_stream(
+        std::chrono::milliseconds(get_config_int("events_hold_ms", default_events_hold_ms)),
+        events_max_waiting);
+
+    // Record the driver traffic to replay it later
+    auto capture_file = get_config_string("capture_file", "");
+    if(!capture_file.empty()){
+        if(start_capture(capture_file)){
+            ASGARD_INFO << "asgard: server: capturing the driver traffic into " << capture_file;
+        } else {
+            ASGARD_ERROR << "asgard: server: unable to open the capture file " << capture_file << ": " << std::strerror(errno);
+        }
+    }
+
     // Run the server with our controller
     Mongoose::Server server(8080);
     server.registerController(&controller);
@@ -743,12 +1435,21 @@ int main() {
     // Start the server and wait forever
     server.start();
 
-    //Register signals for "proper" shutdown
-    signal(SIGTERM, terminate);
-    signal(SIGINT, terminate);
+    //Register signals for "proper" shutdown, run returns once one is received
+    if (pipe2(stop_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        ASGARD_ERROR << "asgard: unable to create the stop pipe: " << std::strerror(errno);
+        return 1;
+    }
+
+    signal(SIGTERM, request_stop);
+    signal(SIGINT, request_stop);
 
     init_led();
     set_led_on();
 
-    return run();
+    auto result = run();
+
+    stop_server(server);
+
+    return result;
 }
@@ -0,0 +1,91 @@
+//=======================================================================
+// Copyright (c) 2015-2016 Baptiste Wicht
+// Distributed under the terms of the MIT License.
+// (See accompanying file LICENSE or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+#include "timer_wheel.hpp"
+
+constexpr std::size_t timer_wheel::levels;
+constexpr std::size_t timer_wheel::slot_bits;
+constexpr std::size_t timer_wheel::slots;
+
+timer_wheel::timer_wheel(std::uint64_t now) : current(now) {}
+
+void timer_wheel::add(std::uint64_t id, std::uint64_t expires){
+    // Timers in the past expire at the next tick
+    if(expires <= current){
+        expires = current + 1;
+    }
+
+    place({id, expires});
+    ++count;
+}
+
+void timer_wheel::place(entry e){
+    // Timers too far in the future wait in the last slot of the wheel and
+    // are placed again, with their real expiry, when it is cascaded
+    const std::uint64_t max_delta = (std::uint64_t(1) << (slot_bits * levels)) - 1;
+    auto target = e.expires - current > max_delta ? current + max_delta : e.expires;
+
+    auto delta = target - current;
+
+    for(std::size_t level = 0; level < levels; ++level){
+        if(delta < (std::uint64_t(1) << (slot_bits * (level + 1))) || level == levels - 1){
+            auto slot = (target >> (slot_bits * level)) & (slots - 1);
+            wheel[level][slot].push_back(e);
+            return;
+        }
+    }
+}
+
+void timer_wheel::cascade(std::size_t level){
+    auto slot = (current >> (slot_bits * level)) & (slots - 1);
+
+    std::vector<entry> entries;
+    entries.swap(wheel[level][slot]);
+
+    for(auto& e : entries){
+        place(e);
+    }
+}
+
+void timer_wheel::tick(std::vector<std::uint64_t>& expired){
+    ++current;
+
+    // Find the highest level reaching a new slot with this tick
+    std::size_t top = 0;
+    while(top + 1 < levels && (current & ((std::uint64_t(1) << (slot_bits * (top + 1))) - 1)) == 0){
+        ++top;
+    }
+
+    // Cascade from the top so that the entries reach the lowest level
+    for(std::size_t level = top; level > 0; --level){
+        cascade(level);
+    }
+
+    auto& slot = wheel[0][current & (slots - 1)];
+
+    std::vector<entry> pending;
+    pending.swap(slot);
+
+    for(auto& e : pending){
+        if(e.expires <= current){
+            expired.push_back(e.id);
+            --count;
+        } else {
+            place(e);
+        }
+    }
+}
+
+void timer_wheel::advance(std::uint64_t now, std::vector<std::uint64_t>& expired){
+    while(current < now){
+        tick(expired);
+    }
+}
+
+std::size_t timer_wheel::size() const {
+    return count;
+}